@@ -0,0 +1,44 @@
+# Everything but main(), shared with the benchmarks
+
+INCLUDEPATH += $$PWD
+
+# qmake CONFIG+=profile builds in the timers, the overlay and tracing
+profile: DEFINES += DIALOGUENODE_PROFILE
+
+SOURCES += \
+    $$PWD/mainwindow.cpp \
+    $$PWD/nodes.cpp \
+    $$PWD/commands.cpp \
+    $$PWD/edges.cpp \
+    $$PWD/graph.cpp \
+    $$PWD/pool.cpp \
+    $$PWD/projectfile.cpp \
+    $$PWD/scriptexporter.cpp \
+    $$PWD/simulator.cpp \
+    $$PWD/analysis.cpp \
+    $$PWD/jobs.cpp \
+    $$PWD/layout.cpp \
+    $$PWD/edgerenderer.cpp \
+    $$PWD/profiler.cpp \
+    $$PWD/spatialgrid.cpp \
+    $$PWD/nodekinds.cpp
+
+HEADERS += \
+    $$PWD/mainwindow.hpp \
+    $$PWD/nodes.hpp \
+    $$PWD/commands.hpp \
+    $$PWD/edges.hpp \
+    $$PWD/graph.hpp \
+    $$PWD/pool.hpp \
+    $$PWD/projectfile.hpp \
+    $$PWD/scriptexporter.hpp \
+    $$PWD/simulator.hpp \
+    $$PWD/analysis.hpp \
+    $$PWD/jobs.hpp \
+    $$PWD/layout.hpp \
+    $$PWD/parallel.hpp \
+    $$PWD/edgerenderer.hpp \
+    $$PWD/profiler.hpp \
+    $$PWD/spatialgrid.hpp \
+    $$PWD/nodekinds.hpp \
+    $$PWD/runtime/dialogueruntime.hpp
@@ -12,15 +12,9 @@ TARGET    = DialogueNode
 TEMPLATE  = app
 
 SOURCES += \
-    main.cpp \
-    mainwindow.cpp \
-    nodes.cpp \
-    commands.cpp
+    main.cpp
 
-HEADERS += \
-    mainwindow.hpp \
-    nodes.hpp \
-    commands.hpp
+include(DialogueNode.pri)
 
 DISTFILES += \
     COPYING.md \
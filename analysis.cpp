@@ -0,0 +1,313 @@
+#include "analysis.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <memory>
+#include <thread>
+
+// Below this many items per thread the work is cheaper than starting one
+static const quint32 MinChunk = 4096;
+
+GraphReport::GraphReport()
+  : entry(NoId)
+{
+}
+
+bool GraphReport::isClean() const
+{
+  return loose.empty() && unreachable.empty() && dangling.empty() && trappedCycles.empty();
+}
+
+bool GraphReport::hasLoose() const
+{
+  return !loose.empty();
+}
+
+GraphAnalysis::GraphAnalysis(const DialogueGraph& graph, unsigned int threads)
+  : graph(graph)
+  , threads(threads ? threads : idealThreadCount())
+{
+}
+
+GraphReport GraphAnalysis::run(const Monitor& monitor) const
+{
+  std::atomic<bool> stopped(false);
+  Monitor check = [&](int percent)
+  {
+    if (!stopped.load() && monitor && !monitor(percent))
+    {
+      stopped.store(true);
+    }
+    return !stopped.load();
+  };
+
+  GraphReport report;
+  report.entry = graph.entry();
+  if (threads > 1 && graph.nodeCount() >= MinChunk)
+  {
+    std::thread cycles([&]() { findTrappedCycles(report, stopped); });
+    findUnreachable(report, check);
+    if (check(60))
+    {
+      findDangling(report);
+      findLoose(report);
+    }
+    check(70);
+    cycles.join();
+  }
+  else
+  {
+    findUnreachable(report, check);
+    if (check(60))
+    {
+      findDangling(report);
+      findLoose(report);
+    }
+    if (check(70))
+    {
+      findTrappedCycles(report, stopped);
+    }
+  }
+  check(100);
+  return report;
+}
+
+void GraphAnalysis::findUnreachable(GraphReport& report, const Monitor& check) const
+{
+  // Level by level search; claiming a node is a single atomic exchange so
+  // threads can expand the same frontier without locking
+  quint32 count = graph.nodeCount();
+  std::unique_ptr<std::atomic<bool>[]> visited(new std::atomic<bool>[count]);
+  for (quint32 node = 0; node < count; node++)
+  {
+    visited[node].store(false, std::memory_order_relaxed);
+  }
+
+  std::vector<std::vector<NodeId>> roots(parallelChunks(threads, count, MinChunk));
+  parallelFor(threads, count, MinChunk, [&](quint32 begin, quint32 end, quint32 chunk)
+  {
+    std::vector<NodeId>& found = roots[chunk];
+    for (NodeId node = begin; node < end; node++)
+    {
+      if (graph.isAlive(node) && graph.incomingCount(node) == 0)
+      {
+        found.push_back(node);
+      }
+    }
+  });
+  for (auto& found : roots)
+  {
+    report.roots.insert(report.roots.end(), found.begin(), found.end());
+  }
+  if (report.roots.empty() && report.entry != NoId)
+  {
+    report.roots.push_back(report.entry);
+  }
+  std::vector<NodeId> frontier = report.roots;
+  for (auto node : frontier)
+  {
+    visited[node].store(true, std::memory_order_relaxed);
+  }
+  std::vector<std::vector<NodeId>> next;
+  quint64 reached = frontier.size();
+  quint64 total = std::max(1u, graph.aliveCount());
+  while (!frontier.empty())
+  {
+    if (!check(int(reached * 50 / total)))
+    {
+      return;
+    }
+    quint32 size = quint32(frontier.size());
+    next.assign(parallelChunks(threads, size, MinChunk), std::vector<NodeId>());
+    parallelFor(threads, size, MinChunk, [&](quint32 begin, quint32 end, quint32 chunk)
+    {
+      std::vector<NodeId>& found = next[chunk];
+      for (quint32 i = begin; i < end; i++)
+      {
+        NodeId node = frontier[i];
+        for (quint32 slot = 0; slot < graph.edgeCount(node); slot++)
+        {
+          NodeId target = graph.edgeTarget(graph.edge(node, slot));
+          if (target != NoId && !visited[target].exchange(true, std::memory_order_relaxed))
+          {
+            found.push_back(target);
+          }
+        }
+      }
+    });
+    frontier.clear();
+    for (auto& found : next)
+    {
+      frontier.insert(frontier.end(), found.begin(), found.end());
+    }
+    reached += frontier.size();
+  }
+
+  std::vector<std::vector<NodeId>> unreachable(parallelChunks(threads, count, MinChunk));
+  parallelFor(threads, count, MinChunk, [&](quint32 begin, quint32 end, quint32 chunk)
+  {
+    std::vector<NodeId>& found = unreachable[chunk];
+    for (NodeId node = begin; node < end; node++)
+    {
+      if (graph.isAlive(node) && !visited[node].load(std::memory_order_relaxed))
+      {
+        found.push_back(node);
+      }
+    }
+  });
+  for (auto& found : unreachable)
+  {
+    report.unreachable.insert(report.unreachable.end(), found.begin(), found.end());
+  }
+}
+
+void GraphAnalysis::findDangling(GraphReport& report) const
+{
+  quint32 count = graph.nodeCount();
+  std::vector<std::vector<EdgeId>> dangling(parallelChunks(threads, count, MinChunk));
+  parallelFor(threads, count, MinChunk, [&](quint32 begin, quint32 end, quint32 chunk)
+  {
+    std::vector<EdgeId>& found = dangling[chunk];
+    for (NodeId node = begin; node < end; node++)
+    {
+      if (!graph.isAlive(node))
+      {
+        continue;
+      }
+      for (quint32 slot = 0; slot < graph.edgeCount(node); slot++)
+      {
+        EdgeId edge = graph.edge(node, slot);
+        if (graph.edgeTarget(edge) == NoId)
+        {
+          found.push_back(edge);
+        }
+      }
+    }
+  });
+  for (auto& found : dangling)
+  {
+    report.dangling.insert(report.dangling.end(), found.begin(), found.end());
+  }
+}
+
+void GraphAnalysis::findLoose(GraphReport& report) const
+{
+  // Roots are the only candidates, as a loose node has nothing leading in
+  for (auto node : report.roots)
+  {
+    bool connected = graph.incomingCount(node) > 0;
+    for (quint32 slot = 0; !connected && slot < graph.edgeCount(node); slot++)
+    {
+      connected = graph.edgeTarget(graph.edge(node, slot)) != NoId;
+    }
+    if (!connected)
+    {
+      report.loose.push_back(node);
+    }
+  }
+}
+
+void GraphAnalysis::findTrappedCycles(GraphReport& report, const std::atomic<bool>& stopped) const
+{
+  // Iterative Tarjan. A component is a trap when every connection of every
+  // node in it is set and stays inside; nodes without any connections end
+  // the conversation, so they never count.
+  struct Frame
+  {
+    NodeId node;
+    quint32 slot;
+  };
+
+  quint32 count = graph.nodeCount();
+  std::vector<quint32> index(count, NoId);
+  std::vector<quint32> low(count, 0);
+  std::vector<quint32> component(count, NoId);
+  std::vector<NodeId> stack;
+  std::vector<Frame> calls;
+  quint32 counter = 0;
+  quint32 components = 0;
+  quint32 steps = 0;
+
+  for (NodeId root = 0; root < count; root++)
+  {
+    if (!graph.isAlive(root) || index[root] != NoId)
+    {
+      continue;
+    }
+    if (stopped.load(std::memory_order_relaxed))
+    {
+      return;
+    }
+    index[root] = low[root] = counter++;
+    stack.push_back(root);
+    calls.push_back(Frame{root, 0});
+    while (!calls.empty())
+    {
+      if ((++steps & 0xffff) == 0 && stopped.load(std::memory_order_relaxed))
+      {
+        return;
+      }
+      Frame& frame = calls.back();
+      NodeId node = frame.node;
+      if (frame.slot < graph.edgeCount(node))
+      {
+        NodeId target = graph.edgeTarget(graph.edge(node, frame.slot++));
+        if (target == NoId)
+        {
+          continue;
+        }
+        if (index[target] == NoId)
+        {
+          index[target] = low[target] = counter++;
+          stack.push_back(target);
+          calls.push_back(Frame{target, 0});
+        }
+        else if (component[target] == NoId)
+        {
+          low[node] = std::min(low[node], index[target]);
+        }
+        continue;
+      }
+
+      calls.pop_back();
+      if (!calls.empty())
+      {
+        NodeId caller = calls.back().node;
+        low[caller] = std::min(low[caller], low[node]);
+      }
+      if (low[node] != index[node])
+      {
+        continue;
+      }
+
+      std::vector<NodeId> members;
+      NodeId member;
+      do
+      {
+        member = stack.back();
+        stack.pop_back();
+        component[member] = components;
+        members.push_back(member);
+      }
+      while (member != node);
+
+      bool trapped = true;
+      for (auto member : members)
+      {
+        quint32 edges = graph.edgeCount(member);
+        trapped = trapped && edges > 0;
+        for (quint32 slot = 0; trapped && slot < edges; slot++)
+        {
+          NodeId target = graph.edgeTarget(graph.edge(member, slot));
+          trapped = target != NoId && component[target] == components;
+        }
+      }
+      if (trapped)
+      {
+        std::sort(members.begin(), members.end());
+        report.trappedCycles.push_back(std::move(members));
+      }
+      components++;
+    }
+  }
+  std::sort(report.trappedCycles.begin(), report.trappedCycles.end());
+}
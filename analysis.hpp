@@ -0,0 +1,54 @@
+#ifndef ANALYSIS_HPP
+#define ANALYSIS_HPP
+
+#include "graph.hpp"
+#include <atomic>
+#include <functional>
+#include <vector>
+
+struct GraphReport
+{
+  GraphReport();
+  bool isClean() const;
+  // Whether Delete Loose Nodes has anything to remove
+  bool hasLoose() const;
+
+  NodeId entry;
+  std::vector<NodeId> roots;
+  std::vector<NodeId> loose;
+  std::vector<NodeId> unreachable;
+  std::vector<EdgeId> dangling;
+  std::vector<std::vector<NodeId>> trappedCycles;
+};
+
+// Checks a whole graph for problems: loose nodes with no connections at all,
+// nodes no conversation can reach, connections that lead nowhere, and loops
+// a conversation can never leave. Every node nothing leads into starts a
+// conversation of its own; only when every node sits in a loop is the graph
+// entry used instead.
+// The graph is only read, so the passes run side by side; the breadth-first
+// search and the scans are further split across threads once the graph is
+// large enough to pay for them.
+//
+// The monitor is called from the calling thread with a rough percentage;
+// returning false stops every pass early and leaves the report partial.
+class GraphAnalysis
+{
+  public:
+    typedef std::function<bool(int percent)> Monitor;
+
+    GraphAnalysis(const DialogueGraph& graph, unsigned int threads = 0);
+
+    GraphReport run(const Monitor& monitor = Monitor()) const;
+
+  private:
+    void findUnreachable(GraphReport& report, const Monitor& check) const;
+    void findDangling(GraphReport& report) const;
+    void findLoose(GraphReport& report) const;
+    void findTrappedCycles(GraphReport& report, const std::atomic<bool>& stopped) const;
+
+    const DialogueGraph& graph;
+    unsigned int threads;
+};
+
+#endif // ANALYSIS_HPP
@@ -0,0 +1,17 @@
+#-------------------------------------------------
+#
+# Scene benchmarks, run headless with
+#   QT_QPA_PLATFORM=offscreen ./scenebench -o results.xml,xml
+#
+#-------------------------------------------------
+
+CONFIG   += c++11
+QT       += core gui widgets testlib
+
+TARGET    = scenebench
+TEMPLATE  = app
+
+include(../DialogueNode.pri)
+
+SOURCES += \
+    scenebench.cpp
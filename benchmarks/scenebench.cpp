@@ -0,0 +1,349 @@
+#include "mainwindow.hpp"
+#include "nodes.hpp"
+#include "commands.hpp"
+#include "edges.hpp"
+#include "projectfile.hpp"
+#include "layout.hpp"
+#include <QtTest>
+#include <QImage>
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+#include <QTemporaryDir>
+#include <vector>
+
+// Chains have one way out of every node, trees fan out three ways with a
+// single way in, and hubs funnel every connection into one node in 64
+enum Shape
+{
+  Chain,
+  Tree,
+  Hubs
+};
+
+// Node kinds take turns so painting and saving go through all of them
+static void buildGraph(DialogueGraph& graph, quint32 count, int shape)
+{
+  for (quint32 i = 0; i < count; i++)
+  {
+    NodeId node = graph.addNode(QPointF((i % 100) * 200.f, (i / 100) * 120.f), NodeKind(i % KindCount));
+    graph.setText(node, QString("Line %1").arg(i));
+  }
+  const quint32 fanOut = shape == Chain ? 1 : shape == Tree ? 3 : 2;
+  const quint32 hubs = qMax(1u, count / 64);
+  for (NodeId node = 0; node < count; node++)
+  {
+    for (quint32 slot = 0; slot < fanOut; slot++)
+    {
+      EdgeId edge = graph.addEdge(node, QString("Choice %1").arg(slot));
+      NodeId target = NoId;
+      if (shape == Chain)
+      {
+        target = node + 1;
+      }
+      else if (shape == Tree)
+      {
+        target = node * fanOut + slot + 1;
+      }
+      else
+      {
+        target = (node * fanOut + slot) % hubs;
+      }
+      if (target < count && target != node)
+      {
+        graph.setEdgeTarget(edge, target);
+      }
+    }
+  }
+}
+
+// A scene built the same way opening a project builds it
+class Document
+{
+  public:
+    Document(quint32 count, int shape)
+      : view(new DialogueView(&scene, &window))
+    {
+      buildGraph(*view->graph(), count, shape);
+      for (NodeId id = 0; id < count; id++)
+      {
+        nodes.push_back(new (view->itemPool()) Node(view, id));
+      }
+      for (auto node : nodes)
+      {
+        node->updatePaths();
+        scene.addItem(node);
+      }
+    }
+
+    MainWindow window;
+    QGraphicsScene scene;
+    DialogueView* view;
+    std::vector<Node*> nodes;
+};
+
+class SceneBench : public QObject
+{
+    Q_OBJECT
+
+  private slots:
+    void paint_data();
+    void paint();
+    void render_data();
+    void render();
+    void renderOverview_data();
+    void renderOverview();
+    void boundingRect_data();
+    void boundingRect();
+    void drag_data();
+    void drag();
+    void moveUndoRedo_data();
+    void moveUndoRedo();
+    void deleteUndoRedo_data();
+    void deleteUndoRedo();
+    void save_data();
+    void save();
+    void load_data();
+    void load();
+    void layout_data();
+    void layout();
+
+  private:
+    void addRows();
+};
+
+void SceneBench::addRows()
+{
+  QTest::addColumn<int>("count");
+  QTest::addColumn<int>("shape");
+  const char* shapes[] = { "chain", "tree", "hubs" };
+  for (int count : { 1000, 10000, 100000 })
+  {
+    for (int shape = Chain; shape <= Hubs; shape++)
+    {
+      QByteArray name = QByteArray::number(count) + " " + shapes[shape];
+      QTest::newRow(name.constData()) << count << shape;
+    }
+  }
+}
+
+void SceneBench::paint_data()
+{
+  addRows();
+}
+
+void SceneBench::paint()
+{
+  QFETCH(int, count);
+  QFETCH(int, shape);
+  Document document(count, shape);
+  QImage image(256, 256, QImage::Format_ARGB32_Premultiplied);
+  QPainter painter(&image);
+  QStyleOptionGraphicsItem option;
+  QBENCHMARK
+  {
+    for (auto node : document.nodes)
+    {
+      static_cast<QGraphicsItem*>(node)->paint(&painter, &option, 0);
+    }
+  }
+}
+
+void SceneBench::render_data()
+{
+  addRows();
+}
+
+void SceneBench::render()
+{
+  QFETCH(int, count);
+  QFETCH(int, shape);
+  Document document(count, shape);
+  document.view->resize(1280, 800);
+  QImage image(1280, 800, QImage::Format_ARGB32_Premultiplied);
+  QBENCHMARK
+  {
+    QPainter painter(&image);
+    document.view->render(&painter);
+  }
+}
+
+void SceneBench::renderOverview_data()
+{
+  addRows();
+}
+
+void SceneBench::renderOverview()
+{
+  QFETCH(int, count);
+  QFETCH(int, shape);
+  Document document(count, shape);
+  document.view->resize(1280, 800);
+  document.view->fitInView(document.scene.itemsBoundingRect(), Qt::KeepAspectRatio);
+  QImage image(1280, 800, QImage::Format_ARGB32_Premultiplied);
+  QBENCHMARK
+  {
+    QPainter painter(&image);
+    document.view->render(&painter);
+  }
+}
+
+void SceneBench::boundingRect_data()
+{
+  addRows();
+}
+
+void SceneBench::boundingRect()
+{
+  QFETCH(int, count);
+  QFETCH(int, shape);
+  Document document(count, shape);
+  qreal total = 0;
+  QBENCHMARK
+  {
+    for (auto node : document.nodes)
+    {
+      total += node->boundingRect().height();
+    }
+  }
+  QVERIFY(total > 0);
+}
+
+void SceneBench::drag_data()
+{
+  addRows();
+}
+
+void SceneBench::drag()
+{
+  // One step of dragging everything the way a mouse drag does: the view
+  // places the whole selection in one muted pass, the connections crossing
+  // its border are rerouted once as the event loop would, and releasing
+  // builds the single MoveCommand
+  QFETCH(int, count);
+  QFETCH(int, shape);
+  Document document(count, shape);
+  for (auto node : document.nodes)
+  {
+    node->setSelected(true);
+  }
+  QObject::connect(document.view, &DialogueView::nodeMoved, [](MoveCommand* movement) { delete movement; });
+  QPointF origin = document.nodes.front()->scenePos();
+  QBENCHMARK
+  {
+    document.view->beginDrag(origin);
+    document.view->dragTo(origin + QPointF(1, 1));
+    document.view->router()->flush();
+    document.view->endDrag();
+  }
+}
+
+void SceneBench::moveUndoRedo_data()
+{
+  addRows();
+}
+
+void SceneBench::moveUndoRedo()
+{
+  QFETCH(int, count);
+  QFETCH(int, shape);
+  Document document(count, shape);
+  std::vector<MoveCommand::Movement> movements;
+  for (auto node : document.nodes)
+  {
+    movements.push_back(MoveCommand::Movement{node, node->pos(), node->pos() + QPointF(40, 0)});
+  }
+  MoveCommand command(std::move(movements));
+  command.redo();
+  QBENCHMARK
+  {
+    command.undo();
+    command.redo();
+  }
+}
+
+void SceneBench::deleteUndoRedo_data()
+{
+  addRows();
+}
+
+void SceneBench::deleteUndoRedo()
+{
+  QFETCH(int, count);
+  QFETCH(int, shape);
+  Document document(count, shape);
+  std::vector<Node*> nodes;
+  for (size_t i = 0; i < document.nodes.size(); i += 10)
+  {
+    nodes.push_back(document.nodes[i]);
+  }
+  DeleteCommand command(nodes);
+  command.redo();
+  QBENCHMARK
+  {
+    command.undo();
+    command.redo();
+  }
+}
+
+void SceneBench::save_data()
+{
+  addRows();
+}
+
+void SceneBench::save()
+{
+  QFETCH(int, count);
+  QFETCH(int, shape);
+  DialogueGraph graph;
+  buildGraph(graph, count, shape);
+  QTemporaryDir dir;
+  QString name = dir.filePath("bench.dlgn");
+  QBENCHMARK
+  {
+    QVERIFY(ProjectFile(name).save(graph));
+  }
+}
+
+void SceneBench::load_data()
+{
+  addRows();
+}
+
+void SceneBench::load()
+{
+  QFETCH(int, count);
+  QFETCH(int, shape);
+  DialogueGraph graph;
+  buildGraph(graph, count, shape);
+  QTemporaryDir dir;
+  QString name = dir.filePath("bench.dlgn");
+  QVERIFY(ProjectFile(name).save(graph));
+  QBENCHMARK
+  {
+    DialogueGraph loaded;
+    QVERIFY(ProjectFile(name).load(loaded));
+  }
+}
+
+void SceneBench::layout_data()
+{
+  addRows();
+}
+
+// A full auto layout as the layout job runs it, threads included
+void SceneBench::layout()
+{
+  QFETCH(int, count);
+  QFETCH(int, shape);
+  DialogueGraph graph;
+  buildGraph(graph, count, shape);
+  std::vector<QSizeF> sizes(count, QSizeF(150, 80));
+  QBENCHMARK
+  {
+    LayeredLayout layout(graph);
+    QCOMPARE(layout.run(sizes).size(), size_t(count));
+  }
+}
+
+QTEST_MAIN(SceneBench)
+#include "scenebench.moc"
@@ -1,108 +1,640 @@
 #include <QGraphicsScene>
+#include <QFile>
+#include <QTemporaryFile>
 #include "commands.hpp"
 #include "nodes.hpp"
+#include "mainwindow.hpp"
+#include "profiler.hpp"
 
-MoveCommand::MoveCommand(std::vector<Movement>&& movements, QUndoCommand* parent)
+template <typename T>
+static bool writeVector(QFile* file, const std::vector<T>& data)
+{
+  qint64 size = qint64(data.size() * sizeof(T));
+  return file->write(reinterpret_cast<const char*>(data.data()), size) == size;
+}
+
+template <typename T>
+static bool readVector(QFile* file, std::vector<T>& data, quint32 count)
+{
+  data.resize(count);
+  qint64 size = qint64(data.size() * sizeof(T));
+  return file->read(reinterpret_cast<char*>(data.data()), size) == size;
+}
+
+template <typename T>
+static qint64 vectorUsage(const std::vector<T>& data)
+{
+  return qint64(data.capacity() * sizeof(T));
+}
+
+template <typename T>
+static void release(std::vector<T>& data)
+{
+  std::vector<T>().swap(data);
+}
+
+HistoryLedger::HistoryLedger(QObject* parent)
+  : QObject(parent)
+  , memory(0)
+  , disk(0)
+  , spillFile(0)
+{
+}
+
+qint64 HistoryLedger::memoryUsage() const
+{
+  return memory;
+}
+
+qint64 HistoryLedger::diskUsage() const
+{
+  return disk;
+}
+
+QFile* HistoryLedger::file()
+{
+  if (!spillFile)
+  {
+    spillFile = new QTemporaryFile(this);
+    if (!spillFile->open())
+    {
+      delete spillFile;
+      spillFile = 0;
+    }
+  }
+  return spillFile;
+}
+
+void HistoryLedger::change(qint64 memoryDelta, qint64 diskDelta)
+{
+  memory += memoryDelta;
+  disk += diskDelta;
+  // Spills are only ever appended, so the space of commands that were freed
+  // or read back is reclaimed all at once when nothing is left on disk
+  if (disk == 0 && spillFile && spillFile->size() > 0)
+  {
+    spillFile->resize(0);
+  }
+}
+
+HistoryCommand::HistoryCommand(QUndoCommand* parent)
   : QUndoCommand(parent)
-  , movements(movements)
+  , ledger(0)
+  , countedMemory(0)
+  , countedDisk(0)
 {
 }
 
-void MoveCommand::undo()
+HistoryCommand::~HistoryCommand()
+{
+  if (ledger)
+  {
+    ledger->change(-countedMemory, -countedDisk);
+  }
+}
+
+qint64 HistoryCommand::diskUsage() const
+{
+  return 0;
+}
+
+bool HistoryCommand::spill(QFile* file)
+{
+  Q_UNUSED(file);
+  return false;
+}
+
+void HistoryCommand::trim()
+{
+}
+
+void HistoryCommand::track(const QUndoCommand* command, HistoryLedger* ledger)
+{
+  auto history = const_cast<HistoryCommand*>(dynamic_cast<const HistoryCommand*>(command));
+  if (history && !history->ledger)
+  {
+    history->ledger = ledger;
+    history->recount();
+  }
+  for (int i = 0; i < command->childCount(); i++)
+  {
+    track(command->child(i), ledger);
+  }
+}
+
+void HistoryCommand::recount()
+{
+  if (!ledger)
+  {
+    return;
+  }
+  qint64 memory = memoryUsage();
+  qint64 disk = diskUsage();
+  ledger->change(memory - countedMemory, disk - countedDisk);
+  countedMemory = memory;
+  countedDisk = disk;
+}
+
+MoveCommand::MoveCommand(std::vector<Movement>&& movements, QUndoCommand* parent)
+  : HistoryCommand(parent)
+  , view(0)
+  , uniform(true)
+  , count(quint32(movements.size()))
+  , spillFile(0)
+  , spillOffset(0)
 {
-  for (auto movement : movements)
+  std::vector<QPointF> positions;
+  nodes.reserve(count);
+  oldPositions.reserve(count);
+  positions.reserve(count);
+  for (auto& movement : movements)
   {
-    movement.node->setPos(movement.oldPos);
+    view = movement.node->view();
+    nodes.push_back(movement.node->id());
+    oldPositions.push_back(movement.oldPos);
+    positions.push_back(movement.newPos);
   }
+  compress(positions);
+}
+
+void MoveCommand::undo()
+{
+  PROFILE_SCOPE("MoveCommand::undo");
+  apply(false);
 }
 
 void MoveCommand::redo()
 {
-  for (auto movement : movements)
+  PROFILE_SCOPE("MoveCommand::redo");
+  apply(true);
+}
+
+int MoveCommand::id() const
+{
+  return 1;
+}
+
+bool MoveCommand::mergeWith(const QUndoCommand* command)
+{
+  auto other = static_cast<const MoveCommand*>(command);
+  if (other->spillFile || other->text() != text() || other->nodes != nodes)
+  {
+    return false;
+  }
+  load();
+  std::vector<QPointF> positions;
+  positions.reserve(count);
+  for (quint32 i = 0; i < count; i++)
+  {
+    positions.push_back(other->uniform ? other->oldPositions[i] + other->offset : other->newPositions[i]);
+  }
+  compress(positions);
+  recount();
+  return true;
+}
+
+qint64 MoveCommand::memoryUsage() const
+{
+  return qint64(sizeof(*this)) + vectorUsage(nodes) + vectorUsage(oldPositions) + vectorUsage(newPositions);
+}
+
+qint64 MoveCommand::diskUsage() const
+{
+  if (!spillFile)
+  {
+    return 0;
+  }
+  return qint64(count) * qint64(sizeof(NodeId) + (uniform ? 1 : 2) * sizeof(QPointF));
+}
+
+bool MoveCommand::spill(QFile* file)
+{
+  if (spillFile || count == 0)
+  {
+    return false;
+  }
+  qint64 offset = file->size();
+  bool ok = file->seek(offset) && writeVector(file, nodes) && writeVector(file, oldPositions);
+  if (!ok || (!uniform && !writeVector(file, newPositions)))
   {
-    movement.node->setPos(movement.newPos);
+    return false;
   }
+  spillFile = file;
+  spillOffset = offset;
+  release(nodes);
+  release(oldPositions);
+  release(newPositions);
+  recount();
+  return true;
+}
+
+void MoveCommand::trim()
+{
+  // With no nodes left apply() has nothing to do, spilled or not
+  spillFile = 0;
+  count = 0;
+  release(nodes);
+  release(oldPositions);
+  release(newPositions);
+  recount();
+}
+
+void MoveCommand::compress(const std::vector<QPointF>& positions)
+{
+  // A plain drag moves everything by the same offset, so only that is kept
+  offset = positions.empty() ? QPointF() : positions.front() - oldPositions.front();
+  uniform = true;
+  for (quint32 i = 0; uniform && i < count; i++)
+  {
+    uniform = oldPositions[i] + offset == positions[i];
+  }
+  if (uniform)
+  {
+    release(newPositions);
+  }
+  else
+  {
+    newPositions = positions;
+  }
+}
+
+void MoveCommand::load()
+{
+  if (!spillFile)
+  {
+    return;
+  }
+  bool ok = spillFile->seek(spillOffset) && readVector(spillFile, nodes, count) &&
+            readVector(spillFile, oldPositions, count);
+  if (ok && !uniform)
+  {
+    ok = readVector(spillFile, newPositions, count);
+  }
+  if (!ok)
+  {
+    qWarning("Could not read back spilled undo history");
+  }
+  spillFile = 0;
+  recount();
+}
+
+void MoveCommand::apply(bool forward)
+{
+  if (count == 0)
+  {
+    return;
+  }
+  load();
+  std::vector<Node*> items;
+  std::vector<QPointF> positions;
+  items.reserve(count);
+  positions.reserve(count);
+  for (quint32 i = 0; i < count; i++)
+  {
+    Node* node = view->nodeItem(nodes[i]);
+    if (node)
+    {
+      items.push_back(node);
+      if (!forward)
+      {
+        positions.push_back(oldPositions[i]);
+      }
+      else
+      {
+        positions.push_back(uniform ? oldPositions[i] + offset : newPositions[i]);
+      }
+    }
+  }
+  view->moveNodes(items, positions);
 }
 
 ConnectCommand::ConnectCommand(NodeConnection* connection, Node* newNode, QUndoCommand* parent)
-  : QUndoCommand(parent)
-  , connection(connection)
-  , oldNode(connection->node())
-  , newNode(newNode)
+  : HistoryCommand(parent)
+  , view(connection->source->view())
+  , edge(connection->edge())
+  , oldNode(view->graph()->edgeTarget(edge))
+  , newNode(newNode ? newNode->id() : NoId)
+{
+}
+
+NodeId ConnectCommand::target() const
 {
+  return newNode;
 }
 
 void ConnectCommand::undo()
 {
-  connection->setNode(oldNode);
+  PROFILE_SCOPE("ConnectCommand::undo");
+  apply(oldNode);
 }
 
 void ConnectCommand::redo()
 {
-  connection->setNode(newNode);
+  PROFILE_SCOPE("ConnectCommand::redo");
+  apply(newNode);
+}
+
+int ConnectCommand::id() const
+{
+  return 2;
+}
+
+bool ConnectCommand::mergeWith(const QUndoCommand* command)
+{
+  auto other = static_cast<const ConnectCommand*>(command);
+  if (other->edge != edge)
+  {
+    return false;
+  }
+  newNode = other->newNode;
+  // Dragging the connection back where it was leaves nothing to undo
+  setObsolete(newNode == oldNode);
+  return true;
+}
+
+qint64 ConnectCommand::memoryUsage() const
+{
+  return qint64(sizeof(*this));
+}
+
+void ConnectCommand::trim()
+{
+  // Older commands are always trimmed first, and a trimmed delete may let
+  // the graph recycle the edge, so it must not be touched again
+  edge = NoId;
 }
 
-DeleteCommand::OldNode::OldNode(Node* node)
-  : node(node)
-  , receivers(node->receivers)
+void ConnectCommand::apply(NodeId node)
 {
-  for (auto& connection : node->connections)
+  if (edge == NoId)
+  {
+    return;
+  }
+  DialogueGraph* graph = view->graph();
+  Node* source = view->nodeItem(graph->edgeSource(edge));
+  if (source)
+  {
+    source->setConnection(int(graph->edgeSlot(edge)), node == NoId ? 0 : view->nodeItem(node));
+  }
+  else
   {
-    connections.insert(std::make_pair(connection.get(), connection->node()));
+    graph->setEdgeTarget(edge, node);
   }
 }
 
 DeleteCommand::DeleteCommand(const std::vector<Node*>& nodes, QUndoCommand* parent)
-  : QUndoCommand(parent)
-  , ownership(false)
+  : HistoryCommand(parent)
+  , view(0)
+  , removed(false)
 {
-  for(auto node : nodes)
+  oldNodes.reserve(nodes.size());
+  for (auto node : nodes)
   {
-    oldNodes.push_back(std::unique_ptr<OldNode>(new OldNode(node)));
+    view = node->view();
+    DialogueGraph* graph = view->graph();
+    OldNode oldNode;
+    oldNode.node = node->id();
+    oldNode.receivers.reserve(graph->incomingCount(node->id()));
+    for (EdgeId edge = graph->firstIncoming(node->id()); edge != NoId; edge = graph->nextIncoming(edge))
+    {
+      oldNode.receivers.push_back(edge);
+    }
+    for (quint32 slot = 0; slot < graph->edgeCount(node->id()); slot++)
+    {
+      oldNode.connections.push_back(graph->edgeTarget(graph->edge(node->id(), slot)));
+    }
+    oldNodes.push_back(std::move(oldNode));
   }
 }
 
 DeleteCommand::~DeleteCommand()
 {
-  if (ownership)
+  // Nodes can no longer come back, so their graph slots are recycled
+  if (removed)
   {
     for (auto& oldNode : oldNodes)
     {
-      delete oldNode->node;
+      view->graph()->releaseNode(oldNode.node);
     }
   }
 }
 
+qint64 DeleteCommand::memoryUsage() const
+{
+  qint64 usage = qint64(sizeof(*this)) + vectorUsage(oldNodes);
+  for (auto& oldNode : oldNodes)
+  {
+    usage += vectorUsage(oldNode.connections) + vectorUsage(oldNode.receivers);
+  }
+  return usage;
+}
+
+void DeleteCommand::trim()
+{
+  if (removed)
+  {
+    for (auto& oldNode : oldNodes)
+    {
+      view->graph()->releaseNode(oldNode.node);
+    }
+  }
+  removed = false;
+  release(oldNodes);
+  recount();
+}
+
 void DeleteCommand::undo()
 {
-  ownership = false;
+  PROFILE_SCOPE("DeleteCommand::undo");
+  removed = false;
+  DialogueGraph* graph = view->graph();
+  for (auto& oldNode : oldNodes)
+  {
+    graph->restoreNode(oldNode.node);
+    view->scene()->addItem(new (view->itemPool()) Node(view, oldNode.node));
+  }
   for (auto& oldNode : oldNodes)
   {
-    oldNode->node->scene()->addItem(oldNode->node);
-    for (auto& connection : oldNode->connections)
+    for (quint32 slot = 0; slot < oldNode.connections.size(); slot++)
     {
-      connection.first->setNode(connection.second);
+      graph->setEdgeTarget(graph->edge(oldNode.node, slot), oldNode.connections[slot]);
     }
-    for (auto& receivers : oldNode->receivers)
+    for (auto edge : oldNode.receivers)
     {
-      receivers->setNode(oldNode->node);
+      graph->setEdgeTarget(edge, oldNode.node);
+    }
+  }
+  for (auto& oldNode : oldNodes)
+  {
+    view->nodeItem(oldNode.node)->updatePaths();
+    for (auto edge : oldNode.receivers)
+    {
+      Node* source = view->nodeItem(graph->edgeSource(edge));
+      if (source)
+      {
+        source->updatePaths();
+      }
     }
   }
 }
 
 void DeleteCommand::redo()
 {
+  PROFILE_SCOPE("DeleteCommand::redo");
+  // The scene items are dropped entirely; undo rebuilds them from the graph
+  removed = true;
+  DialogueGraph* graph = view->graph();
+  std::vector<EdgeId> detached;
   for (auto& oldNode : oldNodes)
   {
-    for (auto& connection : oldNode->node->connections)
+    for (EdgeId edge = graph->firstIncoming(oldNode.node); edge != NoId; edge = graph->nextIncoming(edge))
     {
-      connection->setNode(0);
+      detached.push_back(edge);
     }
-    for (auto& receivers : oldNode->receivers)
+    graph->removeNode(oldNode.node);
+    delete view->nodeItem(oldNode.node);
+  }
+  for (auto edge : detached)
+  {
+    Node* source = view->nodeItem(graph->edgeSource(edge));
+    if (source)
     {
-      receivers->setNode(0);
+      source->updatePaths();
     }
-    oldNode->node->scene()->removeItem(oldNode->node);
   }
-  ownership = true;
+}
+
+AddCommand::AddCommand(Node* node, QUndoCommand* parent)
+  : HistoryCommand(parent)
+  , removal(std::vector<Node*>(1, node))
+  , added(true)
+{
+}
+
+void AddCommand::undo()
+{
+  removal.redo();
+  added = false;
+}
+
+void AddCommand::redo()
+{
+  if (!added)
+  {
+    removal.undo();
+    added = true;
+  }
+}
+
+qint64 AddCommand::memoryUsage() const
+{
+  return qint64(sizeof(*this)) - qint64(sizeof(removal)) + removal.memoryUsage();
+}
+
+void AddCommand::trim()
+{
+  removal.trim();
+  recount();
+}
+
+PinCommand::PinCommand(const std::vector<Node*>& nodes, bool pinned, QUndoCommand* parent)
+  : HistoryCommand(parent)
+  , view(0)
+  , pinned(pinned)
+{
+  this->nodes.reserve(nodes.size());
+  for (auto node : nodes)
+  {
+    view = node->view();
+    this->nodes.push_back(node->id());
+    wasPinned.push_back(view->graph()->isPinned(node->id()));
+  }
+}
+
+void PinCommand::undo()
+{
+  PROFILE_SCOPE("PinCommand::undo");
+  apply(false);
+}
+
+void PinCommand::redo()
+{
+  PROFILE_SCOPE("PinCommand::redo");
+  apply(true);
+}
+
+qint64 PinCommand::memoryUsage() const
+{
+  return qint64(sizeof(*this)) + vectorUsage(nodes) + qint64(wasPinned.capacity() / 8);
+}
+
+void PinCommand::trim()
+{
+  release(nodes);
+  std::vector<bool>().swap(wasPinned);
+  recount();
+}
+
+void PinCommand::apply(bool forward)
+{
+  for (size_t i = 0; i < nodes.size(); i++)
+  {
+    view->graph()->setPinned(nodes[i], forward ? pinned : bool(wasPinned[i]));
+    Node* node = view->nodeItem(nodes[i]);
+    if (node)
+    {
+      node->update();
+    }
+  }
+}
+
+TextCommand::TextCommand(Node* node, const QString& text, QUndoCommand* parent)
+  : HistoryCommand(parent)
+  , view(node->view())
+  , node(node->id())
+  , oldText(node->text())
+  , newText(text)
+{
+}
+
+void TextCommand::undo()
+{
+  PROFILE_SCOPE("TextCommand::undo");
+  apply(oldText);
+}
+
+void TextCommand::redo()
+{
+  PROFILE_SCOPE("TextCommand::redo");
+  apply(newText);
+}
+
+qint64 TextCommand::memoryUsage() const
+{
+  return qint64(sizeof(*this)) + qint64(oldText.capacity() + newText.capacity()) * qint64(sizeof(QChar));
+}
+
+void TextCommand::trim()
+{
+  node = NoId;
+  oldText.clear();
+  newText.clear();
+  recount();
+}
+
+void TextCommand::apply(const QString& text)
+{
+  if (node == NoId)
+  {
+    return;
+  }
+  Node* item = view->nodeItem(node);
+  if (item)
+  {
+    item->setText(text);
+  }
+  else
+  {
+    view->graph()->setText(node, text);
+  }
 }
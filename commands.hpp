@@ -1,17 +1,71 @@
 #ifndef COMMANDS_HPP
 #define COMMANDS_HPP
 
+#include "graph.hpp"
+#include <QObject>
 #include <QUndoCommand>
 #include <QPointF>
-#include <memory>
 #include <vector>
-#include <set>
-#include <map>
 
+class QFile;
+class QTemporaryFile;
 class Node;
 class NodeConnection;
+class DialogueView;
 
-class MoveCommand : public QUndoCommand
+// Running totals for one undo history: the memory its commands use and the
+// bytes they have spilled to disk. Commands report their own changes, so the
+// history is never walked to add them up. Parent it to the undo stack, which
+// deletes its commands before its children.
+class HistoryLedger : public QObject
+{
+  public:
+    HistoryLedger(QObject* parent = 0);
+
+    qint64 memoryUsage() const;
+    qint64 diskUsage() const;
+    QFile* file();
+
+  private:
+    friend class HistoryCommand;
+    void change(qint64 memoryDelta, qint64 diskDelta);
+
+    qint64 memory;
+    qint64 disk;
+    QTemporaryFile* spillFile;
+};
+
+// Commands refer to nodes by graph handle rather than by item, so none of
+// them keeps scene items alive. Bulky payloads can be spilled to a history
+// file once the undo history grows past its memory budget.
+class HistoryCommand : public QUndoCommand
+{
+  public:
+    HistoryCommand(QUndoCommand* parent = 0);
+    ~HistoryCommand();
+
+    virtual qint64 memoryUsage() const = 0;
+    virtual qint64 diskUsage() const;
+    virtual bool spill(QFile* file);
+    // Drops what undoing the command needs, for when spilling cannot bring
+    // the history under budget. Only done commands are trimmed, and
+    // afterwards undo and redo leave the document alone.
+    virtual void trim();
+
+    // Starts reporting the command and its children to the ledger
+    static void track(const QUndoCommand* command, HistoryLedger* ledger);
+
+  protected:
+    // Commands call this whenever their memory or disk usage changes
+    void recount();
+
+  private:
+    HistoryLedger* ledger;
+    qint64 countedMemory;
+    qint64 countedDisk;
+};
+
+class MoveCommand : public HistoryCommand
 {
   public:
     struct Movement
@@ -25,44 +79,124 @@ class MoveCommand : public QUndoCommand
     MoveCommand(std::vector<Movement>&& movements, QUndoCommand* parent = 0);
     void undo();
     void redo();
+    int id() const;
+    bool mergeWith(const QUndoCommand* command);
+    qint64 memoryUsage() const;
+    qint64 diskUsage() const;
+    bool spill(QFile* file);
+    void trim();
 
   private:
-    std::vector<Movement> movements;
+    void apply(bool forward);
+    void compress(const std::vector<QPointF>& newPositions);
+    void load();
+
+    DialogueView* view;
+    std::vector<NodeId> nodes;
+    std::vector<QPointF> oldPositions;
+    std::vector<QPointF> newPositions;
+    QPointF offset;
+    bool uniform;
+    quint32 count;
+    QFile* spillFile;
+    qint64 spillOffset;
 };
 
-class ConnectCommand : public QUndoCommand
+class ConnectCommand : public HistoryCommand
 {
   public:
     ConnectCommand(NodeConnection* connection, Node* newNode, QUndoCommand* parent = 0);
+    NodeId target() const;
     void undo();
     void redo();
+    int id() const;
+    bool mergeWith(const QUndoCommand* command);
+    qint64 memoryUsage() const;
+    void trim();
 
   private:
-    NodeConnection* connection;
-    Node* oldNode;
-    Node* newNode;
+    void apply(NodeId node);
+
+    DialogueView* view;
+    EdgeId edge;
+    NodeId oldNode;
+    NodeId newNode;
 };
 
-class DeleteCommand : public QUndoCommand
+class DeleteCommand : public HistoryCommand
 {
   public:
     struct OldNode
     {
       public:
-        OldNode(Node* node);
-        Node* node;
-        std::set<NodeConnection*> receivers;
-        std::map<NodeConnection*, Node*> connections;
+        NodeId node;
+        std::vector<NodeId> connections;
+        std::vector<EdgeId> receivers;
     };
 
     DeleteCommand(const std::vector<Node*>& nodes, QUndoCommand* parent = 0);
     ~DeleteCommand();
     void undo();
     void redo();
+    qint64 memoryUsage() const;
+    void trim();
+
+  private:
+    DialogueView* view;
+    std::vector<OldNode> oldNodes;
+    bool removed;
+};
+
+// Adding is deleting in reverse. The node is already in the scene when the
+// command is pushed, so the first redo has nothing to do.
+class AddCommand : public HistoryCommand
+{
+  public:
+    AddCommand(Node* node, QUndoCommand* parent = 0);
+    void undo();
+    void redo();
+    qint64 memoryUsage() const;
+    void trim();
 
   private:
-    std::vector<std::unique_ptr<OldNode>> oldNodes;
-    bool ownership;
+    DeleteCommand removal;
+    bool added;
+};
+
+class PinCommand : public HistoryCommand
+{
+  public:
+    PinCommand(const std::vector<Node*>& nodes, bool pinned, QUndoCommand* parent = 0);
+    void undo();
+    void redo();
+    qint64 memoryUsage() const;
+    void trim();
+
+  private:
+    void apply(bool forward);
+
+    DialogueView* view;
+    std::vector<NodeId> nodes;
+    std::vector<bool> wasPinned;
+    bool pinned;
+};
+
+class TextCommand : public HistoryCommand
+{
+  public:
+    TextCommand(Node* node, const QString& text, QUndoCommand* parent = 0);
+    void undo();
+    void redo();
+    qint64 memoryUsage() const;
+    void trim();
+
+  private:
+    void apply(const QString& text);
+
+    DialogueView* view;
+    NodeId node;
+    QString oldText;
+    QString newText;
 };
 
 #endif // COMMANDS_HPP
@@ -0,0 +1,186 @@
+#include "edgerenderer.hpp"
+
+#ifndef QT_NO_OPENGL
+
+#include "mainwindow.hpp"
+#include "nodes.hpp"
+#include <QMatrix4x4>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLWidget>
+#include <algorithm>
+#include <cstddef>
+
+static const int CurveSegments = 16;
+static const GLubyte EdgeColour[4] = { 0, 0, 0, 255 };
+static const GLubyte HighlightColour[4] = { 200, 120, 0, 255 };
+
+static const char* VertexShader =
+  "attribute highp vec2 position;\n"
+  "attribute lowp vec4 colour;\n"
+  "uniform highp mat4 matrix;\n"
+  "varying lowp vec4 fragmentColour;\n"
+  "void main()\n"
+  "{\n"
+  "  fragmentColour = colour;\n"
+  "  gl_Position = matrix * vec4(position, 0.0, 1.0);\n"
+  "}\n";
+
+static const char* FragmentShader =
+  "varying lowp vec4 fragmentColour;\n"
+  "void main()\n"
+  "{\n"
+  "  gl_FragColor = fragmentColour;\n"
+  "}\n";
+
+EdgeRenderer::EdgeRenderer(DialogueView* view, QOpenGLWidget* widget)
+  : view(view)
+  , widget(widget)
+  , program(0)
+  , buffer(QOpenGLBuffer::VertexBuffer)
+  , vertexCount(0)
+  , dirty(true)
+  , builtLowDetail(false)
+  , failed(false)
+{
+}
+
+EdgeRenderer::~EdgeRenderer()
+{
+  // GL objects can only be released with their context current
+  if (widget && (program || buffer.isCreated()))
+  {
+    widget->makeCurrent();
+    buffer.destroy();
+    delete program;
+    widget->doneCurrent();
+  }
+}
+
+void EdgeRenderer::invalidate()
+{
+  dirty = true;
+}
+
+void EdgeRenderer::draw(const QTransform& transform, const QSize& size, bool lowDetail)
+{
+  if (!initialize())
+  {
+    return;
+  }
+  if (dirty || lowDetail != builtLowDetail)
+  {
+    rebuild(lowDetail);
+  }
+  if (vertexCount == 0)
+  {
+    return;
+  }
+
+  QMatrix4x4 matrix;
+  matrix.ortho(0, size.width(), size.height(), 0, -1, 1);
+  matrix *= QMatrix4x4(transform);
+
+  program->bind();
+  program->setUniformValue("matrix", matrix);
+  buffer.bind();
+  program->enableAttributeArray(0);
+  program->enableAttributeArray(1);
+  program->setAttributeBuffer(0, GL_FLOAT, offsetof(Vertex, x), 2, sizeof(Vertex));
+  program->setAttributeBuffer(1, GL_UNSIGNED_BYTE, offsetof(Vertex, colour), 4, sizeof(Vertex));
+  glDrawArrays(GL_LINES, 0, vertexCount);
+  program->disableAttributeArray(1);
+  program->disableAttributeArray(0);
+  buffer.release();
+  program->release();
+}
+
+bool EdgeRenderer::initialize()
+{
+  if (program || failed)
+  {
+    return !failed;
+  }
+  initializeOpenGLFunctions();
+  program = new QOpenGLShaderProgram();
+  program->addShaderFromSourceCode(QOpenGLShader::Vertex, VertexShader);
+  program->addShaderFromSourceCode(QOpenGLShader::Fragment, FragmentShader);
+  program->bindAttributeLocation("position", 0);
+  program->bindAttributeLocation("colour", 1);
+  if (!program->link() || !buffer.create())
+  {
+    failed = true;
+    return false;
+  }
+  buffer.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+  return true;
+}
+
+void EdgeRenderer::rebuild(bool lowDetail)
+{
+  // Paths are kept in source node coordinates; the buffer is in scene
+  // coordinates so a single matrix places everything
+  vertices.clear();
+  DialogueGraph* graph = view->graph();
+  for (NodeId id = 0; id < graph->nodeCount(); id++)
+  {
+    Node* node = view->nodeItem(id);
+    if (!node)
+    {
+      continue;
+    }
+    QPointF origin = node->pos();
+    for (auto& connection : node->connections)
+    {
+      const QPainterPath& path = connection->path;
+      if (path.isEmpty())
+      {
+        continue;
+      }
+      const GLubyte* colour = connection->highlighted ? HighlightColour : EdgeColour;
+      QPointF start = origin + path.elementAt(0);
+      QPointF end = origin + path.elementAt(path.elementCount() - 1);
+      if (lowDetail)
+      {
+        addLine(start, end, colour);
+        continue;
+      }
+      QPointF curve[4];
+      for (int i = 0; i < 4; i++)
+      {
+        curve[i] = origin + path.elementAt(i + 1);
+      }
+      addLine(start, curve[0], colour);
+      QPointF last = curve[0];
+      for (int segment = 1; segment <= CurveSegments; segment++)
+      {
+        qreal t = qreal(segment) / CurveSegments;
+        qreal u = 1 - t;
+        QPointF next = curve[0] * (u * u * u) + curve[1] * (3 * u * u * t) + curve[2] * (3 * u * t * t) + curve[3] * (t * t * t);
+        addLine(last, next, colour);
+        last = next;
+      }
+      addLine(curve[3], end, colour);
+    }
+  }
+
+  buffer.bind();
+  buffer.allocate(vertices.data(), int(vertices.size() * sizeof(Vertex)));
+  buffer.release();
+  vertexCount = int(vertices.size());
+  builtLowDetail = lowDetail;
+  dirty = false;
+}
+
+void EdgeRenderer::addLine(const QPointF& from, const QPointF& to, const GLubyte* colour)
+{
+  Vertex vertex;
+  std::copy(colour, colour + 4, vertex.colour);
+  vertex.x = GLfloat(from.x());
+  vertex.y = GLfloat(from.y());
+  vertices.push_back(vertex);
+  vertex.x = GLfloat(to.x());
+  vertex.y = GLfloat(to.y());
+  vertices.push_back(vertex);
+}
+
+#endif // QT_NO_OPENGL
@@ -0,0 +1,58 @@
+#ifndef EDGERENDERER_HPP
+#define EDGERENDERER_HPP
+
+#include <QtGlobal>
+
+#ifndef QT_NO_OPENGL
+
+#include <QOpenGLBuffer>
+#include <QOpenGLFunctions>
+#include <QPointF>
+#include <QPointer>
+#include <QSize>
+#include <QTransform>
+#include <vector>
+
+class DialogueView;
+class QOpenGLShaderProgram;
+class QOpenGLWidget;
+
+// Draws every connection of an OpenGL viewport with a single draw call.
+// Curves are flattened into one vertex buffer in scene coordinates, which
+// is only rebuilt after connections change, so panning and zooming just
+// upload a new matrix.
+class EdgeRenderer : protected QOpenGLFunctions
+{
+  public:
+    EdgeRenderer(DialogueView* view, QOpenGLWidget* widget);
+    ~EdgeRenderer();
+
+    void invalidate();
+    void draw(const QTransform& transform, const QSize& size, bool lowDetail);
+
+  private:
+    struct Vertex
+    {
+      GLfloat x;
+      GLfloat y;
+      GLubyte colour[4];
+    };
+
+    bool initialize();
+    void rebuild(bool lowDetail);
+    void addLine(const QPointF& from, const QPointF& to, const GLubyte* colour);
+
+    DialogueView* view;
+    QPointer<QOpenGLWidget> widget;
+    QOpenGLShaderProgram* program;
+    QOpenGLBuffer buffer;
+    std::vector<Vertex> vertices;
+    int vertexCount;
+    bool dirty;
+    bool builtLowDetail;
+    bool failed;
+};
+
+#endif // QT_NO_OPENGL
+
+#endif // EDGERENDERER_HPP
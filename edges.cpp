@@ -0,0 +1,158 @@
+#include "edges.hpp"
+#include "nodes.hpp"
+#include "mainwindow.hpp"
+#include <algorithm>
+
+EdgeRouter::EdgeRouter(QObject* parent)
+  : QObject(parent)
+  , scheduled(false)
+{
+}
+
+void EdgeRouter::nodeMoved(Node* node)
+{
+  node->view()->invalidateEdges();
+  for (auto& connection : node->connections)
+  {
+    markDirty(connection.get());
+  }
+  DialogueGraph* graph = node->graph();
+  for (EdgeId edge = graph->firstIncoming(node->id()); edge != NoId; edge = graph->nextIncoming(edge))
+  {
+    Node* source = node->view()->nodeItem(graph->edgeSource(edge));
+    if (source)
+    {
+      markDirty(source->connections[graph->edgeSlot(edge)].get());
+    }
+  }
+}
+
+void EdgeRouter::markDirty(NodeConnection* connection)
+{
+  if (connection->dirty)
+  {
+    return;
+  }
+  connection->dirty = true;
+  dirty.push_back(connection);
+  if (!scheduled)
+  {
+    scheduled = true;
+    QMetaObject::invokeMethod(this, "flush", Qt::QueuedConnection);
+  }
+}
+
+void EdgeRouter::forget(Node* node)
+{
+  auto owned = [node](NodeConnection* connection)
+  {
+    return connection->source == node;
+  };
+  dirty.erase(std::remove_if(dirty.begin(), dirty.end(), owned), dirty.end());
+}
+
+void EdgeRouter::flush()
+{
+  scheduled = false;
+  std::vector<NodeConnection*> edges;
+  edges.swap(dirty);
+  for (auto connection : edges)
+  {
+    connection->route();
+  }
+}
+
+static const int ClipDepth = 6;
+
+static void splitCubic(const QPointF* points, qreal t, QPointF* left, QPointF* right)
+{
+  QPointF ab = points[0] + (points[1] - points[0]) * t;
+  QPointF bc = points[1] + (points[2] - points[1]) * t;
+  QPointF cd = points[2] + (points[3] - points[2]) * t;
+  QPointF abc = ab + (bc - ab) * t;
+  QPointF bcd = bc + (cd - bc) * t;
+  QPointF mid = abc + (bcd - abc) * t;
+  if (left)
+  {
+    left[0] = points[0];
+    left[1] = ab;
+    left[2] = abc;
+    left[3] = mid;
+  }
+  if (right)
+  {
+    right[0] = mid;
+    right[1] = bcd;
+    right[2] = cd;
+    right[3] = points[3];
+  }
+}
+
+static QRectF hull(const QPointF* points)
+{
+  qreal left = qMin(qMin(points[0].x(), points[1].x()), qMin(points[2].x(), points[3].x()));
+  qreal right = qMax(qMax(points[0].x(), points[1].x()), qMax(points[2].x(), points[3].x()));
+  qreal top = qMin(qMin(points[0].y(), points[1].y()), qMin(points[2].y(), points[3].y()));
+  qreal bottom = qMax(qMax(points[0].y(), points[1].y()), qMax(points[2].y(), points[3].y()));
+  return QRectF(QPointF(left, top), QPointF(right, bottom));
+}
+
+bool clipCubic(const QPointF* points, const QRectF& rect, qreal* from, qreal* to)
+{
+  struct Piece
+  {
+    QPointF points[4];
+    qreal begin;
+    qreal end;
+    int depth;
+  };
+
+  *from = 1;
+  *to = 0;
+  Piece stack[ClipDepth + 2];
+  int size = 1;
+  std::copy(points, points + 4, stack[0].points);
+  stack[0].begin = 0;
+  stack[0].end = 1;
+  stack[0].depth = 0;
+  while (size > 0)
+  {
+    Piece piece = stack[--size];
+    QRectF bounds = hull(piece.points);
+    // Hulls of straight pieces have no area, so the edges are compared
+    // directly instead of using intersects()
+    if (bounds.left() > rect.right() || bounds.right() < rect.left()
+        || bounds.top() > rect.bottom() || bounds.bottom() < rect.top())
+    {
+      continue;
+    }
+    if (piece.depth == ClipDepth || rect.contains(bounds))
+    {
+      *from = qMin(*from, piece.begin);
+      *to = qMax(*to, piece.end);
+      continue;
+    }
+    // Nothing inside the range found so far can widen it
+    if (piece.begin >= *from && piece.end <= *to)
+    {
+      continue;
+    }
+    qreal middle = .5f * (piece.begin + piece.end);
+    Piece& second = stack[size];
+    Piece& first = stack[size + 1];
+    splitCubic(piece.points, .5f, first.points, second.points);
+    first.begin = piece.begin;
+    first.end = second.begin = middle;
+    second.end = piece.end;
+    first.depth = second.depth = piece.depth + 1;
+    size += 2;
+  }
+  return *from <= *to;
+}
+
+void cubicSection(const QPointF* points, qreal from, qreal to, QPointF* section)
+{
+  QPointF head[4];
+  splitCubic(points, to, head, 0);
+  splitCubic(head, to > 0 ? from / to : 0, 0, section);
+}
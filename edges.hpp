@@ -0,0 +1,40 @@
+#ifndef EDGES_HPP
+#define EDGES_HPP
+
+#include <QObject>
+#include <QPointF>
+#include <QRectF>
+#include <vector>
+
+class Node;
+class NodeConnection;
+
+// Collects connections whose endpoints moved and reroutes them once per
+// event loop pass instead of on every position change.
+class EdgeRouter : public QObject
+{
+    Q_OBJECT
+  public:
+    EdgeRouter(QObject* parent = 0);
+
+    void nodeMoved(Node* node);
+    void markDirty(NodeConnection* connection);
+    void forget(Node* node);
+
+  public slots:
+    void flush();
+
+  private:
+    std::vector<NodeConnection*> dirty;
+    bool scheduled;
+};
+
+// Narrows a cubic to the parameter range that may cross rect, by splitting
+// it until the control hull of each piece is either outside rect or inside
+// it. Returns false when no part of the curve can be visible.
+bool clipCubic(const QPointF* points, const QRectF& rect, qreal* from, qreal* to);
+
+// Control points of the part of a cubic between two parameters
+void cubicSection(const QPointF* points, qreal from, qreal to, QPointF* section);
+
+#endif // EDGES_HPP
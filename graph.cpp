@@ -0,0 +1,469 @@
+#include "graph.hpp"
+
+DialogueGraph::DialogueGraph()
+  : d(new Data)
+{
+}
+
+DialogueGraph::Data::Data()
+  : alive(0)
+{
+  // The empty string is always there and never counted
+  strings.push_back(QString());
+  stringRefs.push_back(0);
+  stringIds.insert(QString(), EmptyString);
+}
+
+NodeId DialogueGraph::addNode(const QPointF& pos, NodeKind kind)
+{
+  d->alive++;
+  if (!d->freeNodes.empty())
+  {
+    NodeId node = d->freeNodes.back();
+    d->freeNodes.pop_back();
+    NodeData& data = d->nodes[node];
+    data.pos = pos;
+    data.kind = quint8(kind);
+    data.alive = true;
+    data.pinned = false;
+    return node;
+  }
+
+  NodeData data;
+  data.pos = pos;
+  data.text = EmptyString;
+  data.firstEdge = EdgeId(d->edges.size());
+  data.edgeCount = 0;
+  data.edgeCapacity = 0;
+  data.firstIncoming = NoId;
+  data.incomingCount = 0;
+  data.kind = quint8(kind);
+  data.alive = true;
+  data.pinned = false;
+  d->nodes.push_back(std::move(data));
+  return NodeId(d->nodes.size() - 1);
+}
+
+void DialogueGraph::removeNode(NodeId node)
+{
+  NodeData& data = d->nodes[node];
+  if (!data.alive)
+  {
+    return;
+  }
+  for (quint32 slot = 0; slot < data.edgeCount; slot++)
+  {
+    setEdgeTarget(data.firstEdge + slot, NoId);
+  }
+  while (data.firstIncoming != NoId)
+  {
+    setEdgeTarget(data.firstIncoming, NoId);
+  }
+  data.alive = false;
+  d->alive--;
+}
+
+void DialogueGraph::restoreNode(NodeId node)
+{
+  if (!d->nodes[node].alive)
+  {
+    d->nodes[node].alive = true;
+    d->alive++;
+  }
+}
+
+void DialogueGraph::releaseNode(NodeId node)
+{
+  // Only removed nodes can be released, the edge run stays reserved as
+  // capacity for whichever node takes over the slot
+  NodeData& data = d->nodes[node];
+  if (data.alive)
+  {
+    return;
+  }
+  for (quint32 slot = 0; slot < data.edgeCount; slot++)
+  {
+    release(d->edges[data.firstEdge + slot].name);
+    d->edges[data.firstEdge + slot].name = EmptyString;
+  }
+  release(data.text);
+  data.text = EmptyString;
+  data.edgeCount = 0;
+  d->freeNodes.push_back(node);
+}
+
+bool DialogueGraph::isAlive(NodeId node) const
+{
+  return node < d->nodes.size() && d->nodes[node].alive;
+}
+
+quint32 DialogueGraph::nodeCount() const
+{
+  return quint32(d->nodes.size());
+}
+
+quint32 DialogueGraph::aliveCount() const
+{
+  return d->alive;
+}
+
+NodeId DialogueGraph::entry() const
+{
+  // The first node nothing leads into, falling back to the first node when
+  // everything is part of a loop
+  NodeId first = NoId;
+  for (NodeId node = 0; node < d->nodes.size(); node++)
+  {
+    if (!d->nodes[node].alive)
+    {
+      continue;
+    }
+    if (d->nodes[node].incomingCount == 0)
+    {
+      return node;
+    }
+    if (first == NoId)
+    {
+      first = node;
+    }
+  }
+  return first;
+}
+
+NodeKind DialogueGraph::kind(NodeId node) const
+{
+  return NodeKind(d->nodes[node].kind);
+}
+
+void DialogueGraph::setKind(NodeId node, NodeKind kind)
+{
+  d->nodes[node].kind = quint8(kind);
+}
+
+const QPointF& DialogueGraph::position(NodeId node) const
+{
+  return d->nodes[node].pos;
+}
+
+void DialogueGraph::setPosition(NodeId node, const QPointF& pos)
+{
+  d->nodes[node].pos = pos;
+}
+
+const QString& DialogueGraph::text(NodeId node) const
+{
+  return d->strings[d->nodes[node].text];
+}
+
+void DialogueGraph::setText(NodeId node, const QString& text)
+{
+  StringId id = retain(text);
+  release(d->nodes[node].text);
+  d->nodes[node].text = id;
+}
+
+StringId DialogueGraph::textId(NodeId node) const
+{
+  return d->nodes[node].text;
+}
+
+void DialogueGraph::setTextId(NodeId node, StringId text)
+{
+  retain(text);
+  release(d->nodes[node].text);
+  d->nodes[node].text = text;
+}
+
+bool DialogueGraph::isPinned(NodeId node) const
+{
+  return d->nodes[node].pinned;
+}
+
+void DialogueGraph::setPinned(NodeId node, bool pinned)
+{
+  d->nodes[node].pinned = pinned;
+}
+
+EdgeId DialogueGraph::addEdge(NodeId source, const QString& name)
+{
+  NodeData& data = d->nodes[source];
+  if (data.edgeCount == data.edgeCapacity)
+  {
+    if (data.edgeCapacity > 0 && data.firstEdge + data.edgeCapacity == d->edges.size())
+    {
+      // The last run in the array simply grows in place
+      appendEdges(1);
+      data.edgeCapacity++;
+    }
+    else
+    {
+      relocateEdges(source, data.edgeCount + 1);
+    }
+  }
+  EdgeId id = data.firstEdge + data.edgeCount++;
+  EdgeData& edge = d->edges[id];
+  edge.source = source;
+  edge.name = retain(name);
+  return id;
+}
+
+void DialogueGraph::relocateEdges(NodeId node, quint32 capacity)
+{
+  // Slots are only appended while a node is being built, so this is rare.
+  // The old run is kept for the next node that needs one that size.
+  NodeData& data = d->nodes[node];
+  EdgeId first = reserveEdges(capacity);
+  for (quint32 slot = 0; slot < data.edgeCount; slot++)
+  {
+    EdgeId oldEdge = data.firstEdge + slot;
+    NodeId dest = d->edges[oldEdge].dest;
+    EdgeData& edge = d->edges[first + slot];
+    edge.source = node;
+    edge.name = d->edges[oldEdge].name;
+    d->edges[oldEdge].name = EmptyString;
+    if (dest != NoId)
+    {
+      unlink(oldEdge);
+      link(first + slot, dest);
+    }
+    d->edges[oldEdge].source = NoId;
+  }
+  recycleEdges(data.firstEdge, data.edgeCapacity);
+  data.firstEdge = first;
+  data.edgeCapacity = capacity;
+}
+
+EdgeId DialogueGraph::reserveEdges(quint32 count)
+{
+  // The first free run that is big enough is used, and what is left of it
+  // stays free
+  for (auto& run : d->freeRuns)
+  {
+    if (run.count >= count)
+    {
+      EdgeId first = run.first;
+      run.first += count;
+      run.count -= count;
+      if (run.count == 0)
+      {
+        run = d->freeRuns.back();
+        d->freeRuns.pop_back();
+      }
+      return first;
+    }
+  }
+  return appendEdges(count);
+}
+
+EdgeId DialogueGraph::appendEdges(quint32 count)
+{
+  EdgeData blank;
+  blank.source = NoId;
+  blank.dest = NoId;
+  blank.prevIncoming = NoId;
+  blank.nextIncoming = NoId;
+  blank.name = EmptyString;
+  EdgeId first = EdgeId(d->edges.size());
+  d->edges.resize(d->edges.size() + count, blank);
+  return first;
+}
+
+void DialogueGraph::recycleEdges(EdgeId first, quint32 count)
+{
+  if (count == 0)
+  {
+    return;
+  }
+  if (first + count == d->edges.size())
+  {
+    d->edges.resize(first);
+    return;
+  }
+  EdgeRun run = {first, count};
+  d->freeRuns.push_back(run);
+}
+
+quint32 DialogueGraph::edgeCount(NodeId node) const
+{
+  return d->nodes[node].edgeCount;
+}
+
+EdgeId DialogueGraph::edge(NodeId node, quint32 slot) const
+{
+  return d->nodes[node].firstEdge + slot;
+}
+
+EdgeId DialogueGraph::firstIncoming(NodeId node) const
+{
+  return d->nodes[node].firstIncoming;
+}
+
+EdgeId DialogueGraph::nextIncoming(EdgeId edge) const
+{
+  return d->edges[edge].nextIncoming;
+}
+
+quint32 DialogueGraph::incomingCount(NodeId node) const
+{
+  return d->nodes[node].incomingCount;
+}
+
+NodeId DialogueGraph::edgeSource(EdgeId edge) const
+{
+  return d->edges[edge].source;
+}
+
+NodeId DialogueGraph::edgeTarget(EdgeId edge) const
+{
+  return d->edges[edge].dest;
+}
+
+quint32 DialogueGraph::edgeSlot(EdgeId edge) const
+{
+  return edge - d->nodes[d->edges[edge].source].firstEdge;
+}
+
+void DialogueGraph::setEdgeTarget(EdgeId edge, NodeId dest)
+{
+  if (d->edges[edge].dest == dest)
+  {
+    return;
+  }
+  if (d->edges[edge].dest != NoId)
+  {
+    unlink(edge);
+  }
+  if (dest != NoId)
+  {
+    link(edge, dest);
+  }
+}
+
+void DialogueGraph::link(EdgeId edge, NodeId dest)
+{
+  EdgeData& data = d->edges[edge];
+  NodeData& node = d->nodes[dest];
+  data.dest = dest;
+  data.prevIncoming = NoId;
+  data.nextIncoming = node.firstIncoming;
+  if (node.firstIncoming != NoId)
+  {
+    d->edges[node.firstIncoming].prevIncoming = edge;
+  }
+  node.firstIncoming = edge;
+  node.incomingCount++;
+}
+
+void DialogueGraph::unlink(EdgeId edge)
+{
+  EdgeData& data = d->edges[edge];
+  NodeData& node = d->nodes[data.dest];
+  if (data.prevIncoming != NoId)
+  {
+    d->edges[data.prevIncoming].nextIncoming = data.nextIncoming;
+  }
+  else
+  {
+    node.firstIncoming = data.nextIncoming;
+  }
+  if (data.nextIncoming != NoId)
+  {
+    d->edges[data.nextIncoming].prevIncoming = data.prevIncoming;
+  }
+  node.incomingCount--;
+  data.dest = NoId;
+  data.prevIncoming = NoId;
+  data.nextIncoming = NoId;
+}
+
+const QString& DialogueGraph::edgeName(EdgeId edge) const
+{
+  return d->strings[d->edges[edge].name];
+}
+
+void DialogueGraph::setEdgeName(EdgeId edge, const QString& name)
+{
+  StringId id = retain(name);
+  release(d->edges[edge].name);
+  d->edges[edge].name = id;
+}
+
+StringId DialogueGraph::edgeNameId(EdgeId edge) const
+{
+  return d->edges[edge].name;
+}
+
+void DialogueGraph::setEdgeNameId(EdgeId edge, StringId name)
+{
+  retain(name);
+  release(d->edges[edge].name);
+  d->edges[edge].name = name;
+}
+
+quint32 DialogueGraph::stringCount() const
+{
+  return quint32(d->strings.size());
+}
+
+const QString& DialogueGraph::string(StringId id) const
+{
+  return d->strings[id];
+}
+
+StringId DialogueGraph::retain(const QString& string)
+{
+  auto found = d->stringIds.constFind(string);
+  if (found != d->stringIds.constEnd())
+  {
+    retain(found.value());
+    return found.value();
+  }
+  StringId id;
+  if (!d->freeStrings.empty())
+  {
+    id = d->freeStrings.back();
+    d->freeStrings.pop_back();
+    d->strings[id] = string;
+    d->stringRefs[id] = 1;
+  }
+  else
+  {
+    id = StringId(d->strings.size());
+    d->strings.push_back(string);
+    d->stringRefs.push_back(1);
+  }
+  d->stringIds.insert(string, id);
+  return id;
+}
+
+void DialogueGraph::retain(StringId id)
+{
+  if (id != EmptyString)
+  {
+    d->stringRefs[id]++;
+  }
+}
+
+void DialogueGraph::release(StringId id)
+{
+  if (id != EmptyString && --d->stringRefs[id] == 0)
+  {
+    d->stringIds.remove(d->strings[id]);
+    d->strings[id] = QString();
+    d->freeStrings.push_back(id);
+  }
+}
+
+void DialogueGraph::clear()
+{
+  d->nodes.clear();
+  d->edges.clear();
+  d->freeNodes.clear();
+  d->freeRuns.clear();
+  d->alive = 0;
+  d->strings.resize(1);
+  d->stringRefs.resize(1);
+  d->freeStrings.clear();
+  d->stringIds.clear();
+  d->stringIds.insert(QString(), EmptyString);
+}
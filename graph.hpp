@@ -0,0 +1,139 @@
+#ifndef GRAPH_HPP
+#define GRAPH_HPP
+
+#include "nodekinds.hpp"
+#include <QHash>
+#include <QPointF>
+#include <QSharedData>
+#include <QString>
+#include <vector>
+
+typedef quint32 NodeId;
+typedef quint32 EdgeId;
+typedef quint32 StringId;
+const quint32 NoId = 0xffffffffu;
+const StringId EmptyString = 0;
+
+// Scene-independent dialogue graph. Nodes and edges live in flat arrays and
+// are addressed by index, so it can be used without a QApplication. Each node
+// owns a contiguous run of edges, one per outgoing slot. Incoming edges are
+// threaded through the edges themselves, so relinking never allocates.
+// Removed nodes stay parked so they can be restored; once released their
+// slot and edge run are reused by the next node added.
+//
+// Node text and connection names are interned in one table per document:
+// every distinct string is stored once, equal strings have the same id, and
+// a string is dropped once nothing refers to it. Files and exports write the
+// table as it is.
+//
+// Copies share their data until one of them is modified, so handing a
+// snapshot to a background job costs a reference count.
+class DialogueGraph
+{
+  public:
+    DialogueGraph();
+
+    NodeId addNode(const QPointF& pos = QPointF(), NodeKind kind = TextKind);
+    void removeNode(NodeId node);
+    void restoreNode(NodeId node);
+    void releaseNode(NodeId node);
+    bool isAlive(NodeId node) const;
+    quint32 nodeCount() const;
+    quint32 aliveCount() const;
+    // The lowest numbered node nothing leads into, or the lowest numbered
+    // node when everything is part of a loop. A document can hold several
+    // conversations; this only picks a default one to start from.
+    NodeId entry() const;
+
+    NodeKind kind(NodeId node) const;
+    void setKind(NodeId node, NodeKind kind);
+    const QPointF& position(NodeId node) const;
+    void setPosition(NodeId node, const QPointF& pos);
+    const QString& text(NodeId node) const;
+    void setText(NodeId node, const QString& text);
+    StringId textId(NodeId node) const;
+    void setTextId(NodeId node, StringId text);
+    bool isPinned(NodeId node) const;
+    void setPinned(NodeId node, bool pinned);
+
+    EdgeId addEdge(NodeId source, const QString& name = QString());
+    quint32 edgeCount(NodeId node) const;
+    EdgeId edge(NodeId node, quint32 slot) const;
+    EdgeId firstIncoming(NodeId node) const;
+    EdgeId nextIncoming(EdgeId edge) const;
+    quint32 incomingCount(NodeId node) const;
+
+    NodeId edgeSource(EdgeId edge) const;
+    NodeId edgeTarget(EdgeId edge) const;
+    quint32 edgeSlot(EdgeId edge) const;
+    void setEdgeTarget(EdgeId edge, NodeId dest);
+    const QString& edgeName(EdgeId edge) const;
+    void setEdgeName(EdgeId edge, const QString& name);
+    StringId edgeNameId(EdgeId edge) const;
+    void setEdgeNameId(EdgeId edge, StringId name);
+
+    // Released ids are reused and read back as empty strings until then
+    quint32 stringCount() const;
+    const QString& string(StringId id) const;
+
+    void clear();
+
+  private:
+    struct NodeData
+    {
+      QPointF pos;
+      StringId text;
+      EdgeId firstEdge;
+      quint32 edgeCount;
+      quint32 edgeCapacity;
+      EdgeId firstIncoming;
+      quint32 incomingCount;
+      quint8 kind;
+      bool alive;
+      bool pinned;
+    };
+
+    struct EdgeData
+    {
+      NodeId source;
+      NodeId dest;
+      EdgeId prevIncoming;
+      EdgeId nextIncoming;
+      StringId name;
+    };
+
+    struct EdgeRun
+    {
+      EdgeId first;
+      quint32 count;
+    };
+
+    struct Data : public QSharedData
+    {
+      Data();
+
+      std::vector<NodeData> nodes;
+      std::vector<EdgeData> edges;
+      std::vector<NodeId> freeNodes;
+      std::vector<EdgeRun> freeRuns;
+      quint32 alive;
+      std::vector<QString> strings;
+      std::vector<quint32> stringRefs;
+      std::vector<StringId> freeStrings;
+      QHash<QString, StringId> stringIds;
+    };
+
+    void link(EdgeId edge, NodeId dest);
+    void unlink(EdgeId edge);
+    void relocateEdges(NodeId node, quint32 capacity);
+    EdgeId reserveEdges(quint32 count);
+    EdgeId appendEdges(quint32 count);
+    void recycleEdges(EdgeId first, quint32 count);
+    StringId retain(const QString& string);
+    void retain(StringId id);
+    void release(StringId id);
+
+    QSharedDataPointer<Data> d;
+};
+
+#endif // GRAPH_HPP
@@ -0,0 +1,227 @@
+#include "jobs.hpp"
+#include <QRunnable>
+#include <algorithm>
+#include <utility>
+
+class GraphJob::Runner : public QRunnable
+{
+  public:
+    Runner(GraphJob* job)
+      : job(job)
+    {
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+      // Jobs cancelled while still queued are skipped, but every job posts
+      // complete() exactly once so the queue can let go of it
+      if (!job->isCancelled())
+      {
+        job->run();
+      }
+      QMetaObject::invokeMethod(job, "complete", Qt::QueuedConnection);
+    }
+
+  private:
+    GraphJob* job;
+};
+
+GraphJob::GraphJob(const DialogueGraph& graph)
+  : graph(graph)
+  , queue(0)
+  , cancelled(0)
+  , percent(0)
+{
+}
+
+void GraphJob::cancel()
+{
+  cancelled.storeRelease(1);
+}
+
+bool GraphJob::isCancelled() const
+{
+  return cancelled.loadAcquire() != 0;
+}
+
+bool GraphJob::isCancellable() const
+{
+  return true;
+}
+
+int GraphJob::progress() const
+{
+  return percent.loadAcquire();
+}
+
+bool GraphJob::setProgress(int value)
+{
+  if (percent.fetchAndStoreRelaxed(value) != value)
+  {
+    QMetaObject::invokeMethod(this, "postProgress", Qt::QueuedConnection);
+  }
+  return !isCancelled();
+}
+
+void GraphJob::postProgress()
+{
+  if (!isCancelled())
+  {
+    emit progressChanged(progress());
+    if (queue)
+    {
+      queue->updateProgress();
+    }
+  }
+}
+
+void GraphJob::complete()
+{
+  if (!isCancelled())
+  {
+    emit finished();
+  }
+  if (queue)
+  {
+    queue->remove(this);
+  }
+  deleteLater();
+}
+
+AnalysisJob::AnalysisJob(const DialogueGraph& graph)
+  : GraphJob(graph)
+{
+}
+
+const GraphReport& AnalysisJob::report() const
+{
+  return result;
+}
+
+void AnalysisJob::run()
+{
+  result = GraphAnalysis(graph).run([this](int percent) { return setProgress(percent); });
+}
+
+LayoutJob::LayoutJob(const DialogueGraph& graph, std::vector<QSizeF>&& sizes)
+  : GraphJob(graph)
+  , sizes(std::move(sizes))
+{
+}
+
+const std::vector<QPointF>& LayoutJob::positions() const
+{
+  return result;
+}
+
+const LayoutCache& LayoutJob::cache() const
+{
+  return layoutCache;
+}
+
+void LayoutJob::run()
+{
+  LayeredLayout layout(graph);
+  result = layout.run(sizes, [this](int percent) { return setProgress(percent); });
+  layoutCache = layout.cache();
+}
+
+ExportJob::ExportJob(const DialogueGraph& graph, const QString& fileName)
+  : GraphJob(graph)
+  , exporter(fileName)
+  , ok(false)
+{
+}
+
+bool ExportJob::succeeded() const
+{
+  return ok;
+}
+
+const QString& ExportJob::errorString() const
+{
+  return exporter.errorString();
+}
+
+// A cancelled job reports nothing, so an export that had already written
+// its file would go unmentioned; exports are quick and always run through
+bool ExportJob::isCancellable() const
+{
+  return false;
+}
+
+void ExportJob::run()
+{
+  ok = exporter.save(graph);
+}
+
+JobQueue::JobQueue(QObject* parent)
+  : QObject(parent)
+{
+}
+
+JobQueue::~JobQueue()
+{
+  cancelAll();
+  pool.waitForDone();
+  for (auto job : jobs)
+  {
+    job->queue = 0;
+    delete job;
+  }
+}
+
+void JobQueue::start(GraphJob* job)
+{
+  job->queue = this;
+  jobs.push_back(job);
+  if (jobs.size() == 1)
+  {
+    emit busyChanged(true);
+  }
+  pool.start(new GraphJob::Runner(job));
+  updateProgress();
+}
+
+bool JobQueue::isBusy() const
+{
+  return !jobs.empty();
+}
+
+void JobQueue::cancelAll()
+{
+  for (auto job : jobs)
+  {
+    if (job->isCancellable())
+    {
+      job->cancel();
+    }
+  }
+}
+
+void JobQueue::updateProgress()
+{
+  if (jobs.empty())
+  {
+    return;
+  }
+  int total = 0;
+  for (auto job : jobs)
+  {
+    total += job->progress();
+  }
+  emit progressChanged(total / int(jobs.size()));
+}
+
+void JobQueue::remove(GraphJob* job)
+{
+  jobs.erase(std::remove(jobs.begin(), jobs.end(), job), jobs.end());
+  if (jobs.empty())
+  {
+    emit busyChanged(false);
+  }
+  else
+  {
+    updateProgress();
+  }
+}
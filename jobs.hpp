@@ -0,0 +1,131 @@
+#ifndef JOBS_HPP
+#define JOBS_HPP
+
+#include "graph.hpp"
+#include "analysis.hpp"
+#include "layout.hpp"
+#include "scriptexporter.hpp"
+#include <QAtomicInt>
+#include <QObject>
+#include <QThreadPool>
+#include <vector>
+
+class JobQueue;
+
+// A whole-graph pass that runs on a worker thread against a snapshot of the
+// document, so the view stays responsive and later edits cannot race it.
+// The job object itself stays on the GUI thread: the worker only posts
+// queued calls back to it, and finished() is only emitted for jobs that ran
+// to completion. Jobs delete themselves once they are done.
+class GraphJob : public QObject
+{
+    Q_OBJECT
+    friend class JobQueue;
+  public:
+    GraphJob(const DialogueGraph& graph);
+
+    void cancel();
+    bool isCancelled() const;
+    virtual bool isCancellable() const;
+    int progress() const;
+
+  signals:
+    void progressChanged(int percent);
+    void finished();
+
+  protected:
+    virtual void run() = 0;
+    bool setProgress(int percent);
+
+    const DialogueGraph graph;
+
+  private slots:
+    void postProgress();
+    void complete();
+
+  private:
+    class Runner;
+
+    JobQueue* queue;
+    QAtomicInt cancelled;
+    QAtomicInt percent;
+};
+
+class AnalysisJob : public GraphJob
+{
+    Q_OBJECT
+  public:
+    AnalysisJob(const DialogueGraph& graph);
+
+    const GraphReport& report() const;
+
+  protected:
+    void run() Q_DECL_OVERRIDE;
+
+  private:
+    GraphReport result;
+};
+
+class LayoutJob : public GraphJob
+{
+    Q_OBJECT
+  public:
+    LayoutJob(const DialogueGraph& graph, std::vector<QSizeF>&& sizes);
+
+    const std::vector<QPointF>& positions() const;
+    const LayoutCache& cache() const;
+
+  protected:
+    void run() Q_DECL_OVERRIDE;
+
+  private:
+    std::vector<QSizeF> sizes;
+    std::vector<QPointF> result;
+    LayoutCache layoutCache;
+};
+
+class ExportJob : public GraphJob
+{
+    Q_OBJECT
+  public:
+    ExportJob(const DialogueGraph& graph, const QString& fileName);
+
+    bool succeeded() const;
+    const QString& errorString() const;
+    bool isCancellable() const Q_DECL_OVERRIDE;
+
+  protected:
+    void run() Q_DECL_OVERRIDE;
+
+  private:
+    ScriptExporter exporter;
+    bool ok;
+};
+
+class JobQueue : public QObject
+{
+    Q_OBJECT
+    friend class GraphJob;
+  public:
+    JobQueue(QObject* parent = 0);
+    ~JobQueue();
+
+    void start(GraphJob* job);
+    bool isBusy() const;
+
+  public slots:
+    void cancelAll();
+
+  signals:
+    void progressChanged(int percent);
+    void busyChanged(bool busy);
+
+  private:
+    void updateProgress();
+    void remove(GraphJob* job);
+
+    QThreadPool pool;
+    std::vector<GraphJob*> jobs;
+};
+
+#endif // JOBS_HPP
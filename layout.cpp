@@ -0,0 +1,750 @@
+#include "layout.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+
+// Columns narrower than this are sorted on the calling thread
+static const quint32 MinChunk = 2048;
+
+LayoutCache::LayoutCache()
+  : columnSpacing(80.f)
+  , rowSpacing(20.f)
+  , stamp(0)
+  , search(0)
+{
+}
+
+bool LayoutCache::isEmpty() const
+{
+  return columns.empty();
+}
+
+void LayoutCache::clear()
+{
+  layers.clear();
+  columns.clear();
+}
+
+void LayoutCache::forget(NodeId node)
+{
+  if (node < layers.size())
+  {
+    layers[node] = NoId;
+  }
+}
+
+LayeredLayout::LayeredLayout(const DialogueGraph& graph, unsigned int threads)
+  : graph(graph)
+  , threads(threads ? threads : idealThreadCount())
+  , columnSpacing(80.f)
+  , rowSpacing(20.f)
+  , sweeps(4)
+{
+}
+
+void LayeredLayout::setSpacing(qreal column, qreal row)
+{
+  columnSpacing = column;
+  rowSpacing = row;
+}
+
+void LayeredLayout::setSweeps(int sweeps)
+{
+  this->sweeps = sweeps;
+}
+
+std::vector<QPointF> LayeredLayout::run(const std::vector<QSizeF>& sizes, const Monitor& monitor)
+{
+  auto check = [&](int percent) { return !monitor || monitor(percent); };
+  std::vector<QPointF> result(graph.nodeCount());
+
+  breakCycles();
+  assignLayers();
+  insertPlaceholders();
+  if (!check(20))
+  {
+    return result;
+  }
+
+  // Start from the topological order, which keeps subtrees together, with
+  // placeholders in the order their connections were visited
+  quint32 layerCount = 0;
+  for (auto layer : layerOf)
+  {
+    layerCount = std::max(layerCount, layer + 1);
+  }
+  layers.assign(layerCount, std::vector<quint32>());
+  order.assign(nodes.size(), 0);
+  auto append = [&](quint32 vertex)
+  {
+    std::vector<quint32>& layer = layers[layerOf[vertex]];
+    order[vertex] = quint32(layer.size());
+    layer.push_back(vertex);
+  };
+  for (auto vertex : topological)
+  {
+    append(vertex);
+  }
+  for (quint32 vertex = quint32(topological.size()); vertex < nodes.size(); vertex++)
+  {
+    append(vertex);
+  }
+
+  for (int sweep = 0; sweep < sweeps; sweep++)
+  {
+    for (quint32 layer = 1; layer < layerCount; layer++)
+    {
+      orderLayer(layers[layer], predecessors);
+    }
+    for (quint32 layer = layerCount; layer-- > 1;)
+    {
+      orderLayer(layers[layer - 1], successors);
+    }
+    if (!check(20 + 60 * (sweep + 1) / sweeps))
+    {
+      return result;
+    }
+  }
+
+  heights.assign(nodes.size(), 0.f);
+  rows.assign(nodes.size(), 0.f);
+  for (auto& layer : layers)
+  {
+    qreal y = 0.f;
+    for (auto vertex : layer)
+    {
+      heights[vertex] = nodes[vertex] == NoId ? 0.f : sizes[nodes[vertex]].height();
+      rows[vertex] = y;
+      y += heights[vertex] + rowSpacing;
+    }
+  }
+  for (int pass = 0; pass < 2; pass++)
+  {
+    for (quint32 layer = 1; layer < layerCount; layer++)
+    {
+      placeLayer(layers[layer], predecessors);
+    }
+    for (quint32 layer = layerCount; layer-- > 1;)
+    {
+      placeLayer(layers[layer - 1], successors);
+    }
+  }
+
+  std::vector<qreal> columns(layerCount, 0.f);
+  qreal x = 0.f;
+  for (quint32 layer = 0; layer < layerCount; layer++)
+  {
+    qreal width = 0.f;
+    for (auto vertex : layers[layer])
+    {
+      if (nodes[vertex] != NoId)
+      {
+        width = std::max(width, qreal(sizes[nodes[vertex]].width()));
+      }
+    }
+    columns[layer] = x;
+    x += width + columnSpacing;
+  }
+  qreal top = 0.f;
+  bool first = true;
+  for (quint32 vertex = 0; vertex < nodes.size(); vertex++)
+  {
+    if (nodes[vertex] != NoId && (first || rows[vertex] < top))
+    {
+      top = rows[vertex];
+      first = false;
+    }
+  }
+  layoutCache.layers.assign(graph.nodeCount(), NoId);
+  for (quint32 vertex = 0; vertex < nodes.size(); vertex++)
+  {
+    if (nodes[vertex] != NoId)
+    {
+      result[nodes[vertex]] = QPointF(columns[layerOf[vertex]], rows[vertex] - top);
+      layoutCache.layers[nodes[vertex]] = layerOf[vertex];
+    }
+  }
+  layoutCache.columns.swap(columns);
+  layoutCache.columnSpacing = columnSpacing;
+  layoutCache.rowSpacing = rowSpacing;
+  check(100);
+  return result;
+}
+
+const LayoutCache& LayeredLayout::cache() const
+{
+  return layoutCache;
+}
+
+void LayeredLayout::breakCycles()
+{
+  // Any edge back into the current depth-first path closes a loop; turning
+  // those around leaves a DAG. Starting at the entry keeps the main thread
+  // of the conversation pointing forwards.
+  struct Frame
+  {
+    quint32 vertex;
+    quint32 slot;
+  };
+
+  nodes.clear();
+  vertexOf.assign(graph.nodeCount(), NoId);
+  for (NodeId node = 0; node < graph.nodeCount(); node++)
+  {
+    if (graph.isAlive(node))
+    {
+      vertexOf[node] = quint32(nodes.size());
+      nodes.push_back(node);
+    }
+  }
+  quint32 count = quint32(nodes.size());
+  successors.assign(count, std::vector<quint32>());
+  predecessors.assign(count, std::vector<quint32>());
+
+  std::vector<quint8> state(count, 0);
+  std::vector<Frame> stack;
+  std::vector<quint32> roots;
+  if (graph.entry() != NoId)
+  {
+    roots.push_back(vertexOf[graph.entry()]);
+  }
+  for (quint32 vertex = 0; vertex < count; vertex++)
+  {
+    roots.push_back(vertex);
+  }
+  for (auto root : roots)
+  {
+    if (state[root])
+    {
+      continue;
+    }
+    state[root] = 1;
+    stack.push_back(Frame{root, 0});
+    while (!stack.empty())
+    {
+      Frame& frame = stack.back();
+      quint32 vertex = frame.vertex;
+      NodeId node = nodes[vertex];
+      if (frame.slot < graph.edgeCount(node))
+      {
+        NodeId target = graph.edgeTarget(graph.edge(node, frame.slot++));
+        quint32 next = target == NoId ? NoId : vertexOf[target];
+        if (next == NoId || next == vertex)
+        {
+          continue;
+        }
+        if (state[next] == 1)
+        {
+          successors[next].push_back(vertex);
+        }
+        else
+        {
+          successors[vertex].push_back(next);
+          if (state[next] == 0)
+          {
+            state[next] = 1;
+            stack.push_back(Frame{next, 0});
+          }
+        }
+        continue;
+      }
+      state[vertex] = 2;
+      stack.pop_back();
+    }
+  }
+
+  for (quint32 vertex = 0; vertex < count; vertex++)
+  {
+    std::vector<quint32>& next = successors[vertex];
+    std::sort(next.begin(), next.end());
+    next.erase(std::unique(next.begin(), next.end()), next.end());
+    for (auto target : next)
+    {
+      predecessors[target].push_back(vertex);
+    }
+  }
+}
+
+void LayeredLayout::assignLayers()
+{
+  // Longest path from the sources, then sources are pulled up against their
+  // nearest successor so a late entry into a branch does not leave a long
+  // connection behind
+  quint32 count = quint32(nodes.size());
+  std::vector<quint32> pending(count);
+  topological.clear();
+  for (quint32 vertex = 0; vertex < count; vertex++)
+  {
+    pending[vertex] = quint32(predecessors[vertex].size());
+    if (pending[vertex] == 0)
+    {
+      topological.push_back(vertex);
+    }
+  }
+  layerOf.assign(count, 0);
+  for (size_t i = 0; i < topological.size(); i++)
+  {
+    quint32 vertex = topological[i];
+    for (auto next : successors[vertex])
+    {
+      layerOf[next] = std::max(layerOf[next], layerOf[vertex] + 1);
+      if (--pending[next] == 0)
+      {
+        topological.push_back(next);
+      }
+    }
+  }
+  for (quint32 vertex = 0; vertex < count; vertex++)
+  {
+    if (predecessors[vertex].empty() && !successors[vertex].empty())
+    {
+      quint32 nearest = layerOf[successors[vertex].front()];
+      for (auto next : successors[vertex])
+      {
+        nearest = std::min(nearest, layerOf[next]);
+      }
+      layerOf[vertex] = nearest - 1;
+    }
+  }
+}
+
+void LayeredLayout::insertPlaceholders()
+{
+  quint32 original = quint32(nodes.size());
+  for (quint32 vertex = 0; vertex < original; vertex++)
+  {
+    std::vector<quint32> targets;
+    targets.swap(successors[vertex]);
+    for (auto& target : targets)
+    {
+      if (layerOf[target] - layerOf[vertex] <= 1)
+      {
+        continue;
+      }
+      quint32 first = quint32(nodes.size());
+      quint32 previous = vertex;
+      for (quint32 layer = layerOf[vertex] + 1; layer < layerOf[target]; layer++)
+      {
+        quint32 placeholder = quint32(nodes.size());
+        nodes.push_back(NoId);
+        layerOf.push_back(layer);
+        successors.push_back(std::vector<quint32>());
+        predecessors.push_back(std::vector<quint32>(1, previous));
+        if (previous != vertex)
+        {
+          successors[previous].push_back(placeholder);
+        }
+        previous = placeholder;
+      }
+      successors[previous].push_back(target);
+      std::replace(predecessors[target].begin(), predecessors[target].end(), vertex, previous);
+      target = first;
+    }
+    successors[vertex].swap(targets);
+  }
+}
+
+void LayeredLayout::orderLayer(std::vector<quint32>& layer, const std::vector<std::vector<quint32>>& neighbours)
+{
+  // Barycentres only read the fixed neighbouring column, so wide columns
+  // are split across threads. Vertices with no neighbours keep their place.
+  quint32 size = quint32(layer.size());
+  std::vector<std::pair<qreal, quint32>> keys(size);
+  parallelFor(threads, size, MinChunk, [&](quint32 begin, quint32 end, quint32)
+  {
+    for (quint32 i = begin; i < end; i++)
+    {
+      quint32 vertex = layer[i];
+      const std::vector<quint32>& adjacent = neighbours[vertex];
+      qreal key = qreal(i);
+      if (!adjacent.empty())
+      {
+        qreal sum = 0.f;
+        for (auto other : adjacent)
+        {
+          sum += order[other];
+        }
+        key = sum / adjacent.size();
+      }
+      keys[i] = std::make_pair(key, vertex);
+    }
+  });
+  std::stable_sort(keys.begin(), keys.end(), [](const std::pair<qreal, quint32>& a, const std::pair<qreal, quint32>& b)
+  {
+    return a.first < b.first;
+  });
+  for (quint32 i = 0; i < size; i++)
+  {
+    layer[i] = keys[i].second;
+    order[layer[i]] = i;
+  }
+}
+
+void LayeredLayout::placeLayer(const std::vector<quint32>& layer, const std::vector<std::vector<quint32>>& neighbours)
+{
+  // Each vertex wants to sit centred on its neighbours. Packing downwards
+  // and packing upwards both keep the order and spacing, and so does their
+  // average, which spreads any conflict evenly.
+  size_t size = layer.size();
+  if (size == 0)
+  {
+    return;
+  }
+  std::vector<qreal> desired(size);
+  for (size_t i = 0; i < size; i++)
+  {
+    quint32 vertex = layer[i];
+    const std::vector<quint32>& adjacent = neighbours[vertex];
+    desired[i] = rows[vertex];
+    if (!adjacent.empty())
+    {
+      qreal sum = 0.f;
+      for (auto other : adjacent)
+      {
+        sum += rows[other] + .5f * heights[other];
+      }
+      desired[i] = sum / adjacent.size() - .5f * heights[vertex];
+    }
+  }
+  std::vector<qreal> down(desired);
+  for (size_t i = 1; i < size; i++)
+  {
+    down[i] = std::max(desired[i], down[i - 1] + heights[layer[i - 1]] + rowSpacing);
+  }
+  std::vector<qreal> up(desired);
+  for (size_t i = size - 1; i-- > 0;)
+  {
+    up[i] = std::min(desired[i], up[i + 1] - heights[layer[i]] - rowSpacing);
+  }
+  for (size_t i = 0; i < size; i++)
+  {
+    rows[layer[i]] = .5f * (down[i] + up[i]);
+  }
+}
+
+static qreal freeRow(const std::vector<std::pair<qreal, qreal>>& taken, qreal desired, qreal height, qreal spacing)
+{
+  // Taken spans are sorted by top; overlapping ones are merged into runs and
+  // the row closest to the desired one is picked from the gaps between them
+  const qreal far = std::numeric_limits<qreal>::max();
+  qreal best = desired;
+  qreal bestDistance = far;
+  qreal top = -far;
+  size_t i = 0;
+  for (;;)
+  {
+    qreal bottom = far;
+    qreal next = far;
+    if (i < taken.size())
+    {
+      bottom = taken[i].first - spacing;
+      qreal end = taken[i].second;
+      for (i++; i < taken.size() && taken[i].first - spacing < end + spacing; i++)
+      {
+        end = std::max(end, taken[i].second);
+      }
+      next = end + spacing;
+    }
+    if (bottom - top >= height)
+    {
+      qreal row = std::min(std::max(desired, top), bottom - height);
+      if (std::abs(row - desired) < bestDistance)
+      {
+        best = row;
+        bestDistance = std::abs(row - desired);
+      }
+    }
+    if (next == far || next > desired + bestDistance)
+    {
+      return best;
+    }
+    top = next;
+  }
+}
+
+LocalLayout::LocalLayout(const DialogueGraph& graph, const SpatialGrid& grid, LayoutCache& cache)
+  : graph(graph)
+  , grid(grid)
+  , cache(cache)
+{
+}
+
+LayoutCache::Scratch& LocalLayout::visit(NodeId node)
+{
+  LayoutCache::Scratch& entry = cache.scratch[node];
+  if (entry.stamp != cache.stamp)
+  {
+    entry.stamp = cache.stamp;
+    entry.box = grid.box(node);
+    entry.original = layer(node, entry.box);
+    entry.layer = entry.original;
+    entry.pending = 0;
+    entry.flags = 0;
+  }
+  return entry;
+}
+
+quint32 LocalLayout::layer(NodeId node, const QRectF& box) const
+{
+  // Nodes added since the last layout belong to whichever column they are in
+  if (node < cache.layers.size() && cache.layers[node] != NoId)
+  {
+    return cache.layers[node];
+  }
+  auto next = std::upper_bound(cache.columns.begin(), cache.columns.end(), box.center().x());
+  return next == cache.columns.begin() ? 0 : quint32(next - cache.columns.begin() - 1);
+}
+
+qreal LocalLayout::column(quint32 layer, qreal width) const
+{
+  if (layer < cache.columns.size())
+  {
+    return cache.columns[layer];
+  }
+  size_t last = cache.columns.size() - 1;
+  qreal pitch = last > 0 ? cache.columns[last] - cache.columns[last - 1] : width + cache.columnSpacing;
+  return cache.columns[last] + pitch * (layer - last);
+}
+
+bool LocalLayout::closesLoop(NodeId node)
+{
+  // Each search has a stamp of its own, so nothing is cleared between roots
+  if (++cache.search == 0)
+  {
+    for (auto& entry : cache.scratch)
+    {
+      entry.search = 0;
+    }
+    cache.search = 1;
+  }
+  std::vector<NodeId> stack(1, node);
+  cache.scratch[node].search = cache.search;
+  while (!stack.empty())
+  {
+    NodeId current = stack.back();
+    stack.pop_back();
+    for (quint32 slot = 0; slot < graph.edgeCount(current); slot++)
+    {
+      NodeId target = graph.edgeTarget(graph.edge(current, slot));
+      if (target == node)
+      {
+        return true;
+      }
+      if (target != NoId && cache.scratch[target].search != cache.search)
+      {
+        cache.scratch[target].search = cache.search;
+        stack.push_back(target);
+      }
+    }
+  }
+  return false;
+}
+
+std::vector<std::pair<NodeId, QPointF>> LocalLayout::run(const std::vector<NodeId>& roots)
+{
+  std::vector<std::pair<NodeId, QPointF>> moved;
+  if (cache.isEmpty())
+  {
+    return moved;
+  }
+  quint32 count = graph.nodeCount();
+  if (cache.scratch.size() < count)
+  {
+    LayoutCache::Scratch blank = {0, 0, NoId, NoId, 0, 0, QRectF()};
+    cache.scratch.resize(count, blank);
+  }
+  if (++cache.stamp == 0)
+  {
+    for (auto& entry : cache.scratch)
+    {
+      entry.stamp = 0;
+    }
+    cache.stamp = 1;
+  }
+
+  // Collect what lies downstream of the roots along links that pointed
+  // forwards before the edit; links into an earlier column are loops and
+  // are ignored, as the full layout does
+  auto isForward = [&](NodeId source, NodeId target)
+  {
+    return source != target && visit(source).original <= visit(target).original;
+  };
+  std::vector<NodeId> walk;
+  for (auto root : roots)
+  {
+    if (root < count && graph.isAlive(root) && !graph.isPinned(root) && !(visit(root).flags & Affected))
+    {
+      visit(root).flags |= Affected | Root;
+      walk.push_back(root);
+    }
+  }
+  for (size_t i = 0; i < walk.size(); i++)
+  {
+    NodeId node = walk[i];
+    for (quint32 slot = 0; slot < graph.edgeCount(node); slot++)
+    {
+      NodeId target = graph.edgeTarget(graph.edge(node, slot));
+      if (target != NoId && !(visit(target).flags & Affected) && !graph.isPinned(target) && isForward(node, target))
+      {
+        visit(target).flags |= Affected;
+        walk.push_back(target);
+      }
+    }
+  }
+
+  // Longest path over the affected nodes in topological order; whatever a
+  // same-column loop leaves over goes last in walk order
+  for (auto node : walk)
+  {
+    for (EdgeId edge = graph.firstIncoming(node); edge != NoId; edge = graph.nextIncoming(edge))
+    {
+      NodeId source = graph.edgeSource(edge);
+      if ((visit(source).flags & Affected) && isForward(source, node))
+      {
+        visit(node).pending++;
+      }
+    }
+  }
+  std::vector<NodeId> sorted;
+  for (auto node : walk)
+  {
+    if (visit(node).pending == 0)
+    {
+      sorted.push_back(node);
+      visit(node).flags |= Done;
+    }
+  }
+  for (size_t i = 0; i < sorted.size(); i++)
+  {
+    NodeId node = sorted[i];
+    for (quint32 slot = 0; slot < graph.edgeCount(node); slot++)
+    {
+      NodeId target = graph.edgeTarget(graph.edge(node, slot));
+      if (target == NoId)
+      {
+        continue;
+      }
+      LayoutCache::Scratch& entry = visit(target);
+      if ((entry.flags & Affected) && !(entry.flags & Done) && isForward(node, target) && --entry.pending == 0)
+      {
+        sorted.push_back(target);
+        entry.flags |= Done;
+      }
+    }
+  }
+  for (auto node : walk)
+  {
+    if (!(visit(node).flags & Done))
+    {
+      sorted.push_back(node);
+    }
+  }
+
+  std::vector<NodeId> changed;
+  for (auto node : sorted)
+  {
+    quint32 forward = NoId;
+    quint32 any = NoId;
+    for (EdgeId edge = graph.firstIncoming(node); edge != NoId; edge = graph.nextIncoming(edge))
+    {
+      NodeId source = graph.edgeSource(edge);
+      if (source == node)
+      {
+        continue;
+      }
+      quint32 after = visit(source).layer + 1;
+      any = any == NoId ? after : std::max(any, after);
+      if (isForward(source, node))
+      {
+        forward = forward == NoId ? after : std::max(forward, after);
+      }
+    }
+
+    // A root whose only links come from later columns was just attached,
+    // unless it leads back to them itself, which makes those links loops
+    LayoutCache::Scratch& entry = visit(node);
+    quint32 newLayer = entry.layer;
+    if (forward != NoId)
+    {
+      newLayer = forward;
+    }
+    else if (any != NoId && (entry.flags & Root) && !closesLoop(node))
+    {
+      newLayer = any;
+    }
+    if (newLayer != entry.layer)
+    {
+      entry.layer = newLayer;
+      entry.flags |= Moving;
+      changed.push_back(node);
+    }
+  }
+  if (changed.empty())
+  {
+    return moved;
+  }
+
+  // Everything left in place in a column is an obstacle there; columns are
+  // only gathered from the grid once something lands in them
+  std::unordered_map<quint32, std::vector<std::pair<qreal, qreal>>> taken;
+  auto spansIn = [&](quint32 target, qreal width) -> std::vector<std::pair<qreal, qreal>>&
+  {
+    auto found = taken.find(target);
+    if (found != taken.end())
+    {
+      return found->second;
+    }
+    std::vector<std::pair<qreal, qreal>>& spans = taken[target];
+    QRectF bounds = grid.bounds();
+    for (auto node : grid.query(QRectF(column(target, width), bounds.top(), width, bounds.height())))
+    {
+      const LayoutCache::Scratch& entry = visit(node);
+      if (!(entry.flags & Moving))
+      {
+        spans.push_back(std::make_pair(entry.box.top(), entry.box.bottom()));
+      }
+    }
+    std::sort(spans.begin(), spans.end());
+    return spans;
+  };
+
+  if (cache.layers.size() < count)
+  {
+    cache.layers.resize(count, NoId);
+  }
+  for (auto node : changed)
+  {
+    LayoutCache::Scratch& entry = visit(node);
+    QRectF& box = entry.box;
+    qreal desired = box.top();
+    qreal sum = 0.f;
+    int sources = 0;
+    for (EdgeId edge = graph.firstIncoming(node); edge != NoId; edge = graph.nextIncoming(edge))
+    {
+      NodeId source = graph.edgeSource(edge);
+      if (source != node && visit(source).layer < entry.layer)
+      {
+        sum += visit(source).box.center().y();
+        sources++;
+      }
+    }
+    if (sources > 0)
+    {
+      desired = sum / sources - .5f * box.height();
+    }
+
+    quint32 target = entry.layer;
+    std::vector<std::pair<qreal, qreal>>& spans = spansIn(target, box.width());
+    qreal row = freeRow(spans, desired, box.height(), cache.rowSpacing);
+    QPointF corner(column(target, box.width()), row);
+    box.moveTopLeft(corner);
+    spans.insert(std::upper_bound(spans.begin(), spans.end(), std::make_pair(row, row + box.height())),
+                 std::make_pair(row, row + box.height()));
+    cache.layers[node] = target;
+    moved.push_back(std::make_pair(node, corner));
+  }
+  return moved;
+}
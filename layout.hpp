@@ -0,0 +1,129 @@
+#ifndef LAYOUT_HPP
+#define LAYOUT_HPP
+
+#include "graph.hpp"
+#include "spatialgrid.hpp"
+#include <QPointF>
+#include <QRectF>
+#include <QSizeF>
+#include <functional>
+#include <utility>
+#include <vector>
+
+// Column assignment and spacing of the last full layout, kept so later edits
+// can be placed locally. Columns are left edges in scene coordinates.
+struct LayoutCache
+{
+  // Per node working state of a local layout. Entries only count while
+  // their stamp matches the current run, so nothing is cleared between
+  // runs and each run pays for the nodes it touches, not the graph.
+  struct Scratch
+  {
+    quint32 stamp;
+    quint32 search;
+    quint32 original;
+    quint32 layer;
+    quint32 pending;
+    quint32 flags;
+    QRectF box;
+  };
+
+  LayoutCache();
+  bool isEmpty() const;
+  void clear();
+  // Ids are recycled, so a new node must not inherit an old one's column
+  void forget(NodeId node);
+
+  std::vector<quint32> layers;
+  std::vector<qreal> columns;
+  qreal columnSpacing;
+  qreal rowSpacing;
+  std::vector<Scratch> scratch;
+  quint32 stamp;
+  quint32 search;
+};
+
+// Layered placement in the Sugiyama style, with columns running the way
+// connections point. Loops are broken by turning back edges found by a
+// depth-first search around, each node goes one column past its furthest
+// predecessor, and long connections get placeholders so they take part in
+// ordering. Columns are then sorted by barycentre in alternating sweeps to
+// cut crossings, and rows are pulled towards their neighbours as far as the
+// spacing allows.
+//
+// Sizes and results are indexed by NodeId; a result is the top left corner
+// of the node's box, with the whole layout starting at the origin.
+class LayeredLayout
+{
+  public:
+    typedef std::function<bool(int percent)> Monitor;
+
+    LayeredLayout(const DialogueGraph& graph, unsigned int threads = 0);
+
+    void setSpacing(qreal column, qreal row);
+    void setSweeps(int sweeps);
+    std::vector<QPointF> run(const std::vector<QSizeF>& sizes, const Monitor& monitor = Monitor());
+    const LayoutCache& cache() const;
+
+  private:
+    void breakCycles();
+    void assignLayers();
+    void insertPlaceholders();
+    void orderLayer(std::vector<quint32>& layer, const std::vector<std::vector<quint32>>& neighbours);
+    void placeLayer(const std::vector<quint32>& layer, const std::vector<std::vector<quint32>>& neighbours);
+
+    const DialogueGraph& graph;
+    unsigned int threads;
+    qreal columnSpacing;
+    qreal rowSpacing;
+    int sweeps;
+
+    std::vector<NodeId> nodes;
+    std::vector<quint32> vertexOf;
+    std::vector<std::vector<quint32>> successors;
+    std::vector<std::vector<quint32>> predecessors;
+    std::vector<quint32> topological;
+    std::vector<quint32> layerOf;
+    std::vector<std::vector<quint32>> layers;
+    std::vector<quint32> order;
+    std::vector<qreal> heights;
+    std::vector<qreal> rows;
+    LayoutCache layoutCache;
+};
+
+// Re-places only what an edit disturbed. Columns are recomputed for the
+// subtree downstream of the given roots, seeded from the cached layering,
+// and only nodes whose column actually changes are moved. Pinned nodes are
+// never moved or walked through, and everything else is left exactly where
+// the writer put it.
+//
+// Boxes and the obstacles in each column come from the spatial grid, so
+// only the edited region and the columns it lands in are looked at. The
+// result lists the new top left corner of each node that moved.
+class LocalLayout
+{
+  public:
+    LocalLayout(const DialogueGraph& graph, const SpatialGrid& grid, LayoutCache& cache);
+
+    std::vector<std::pair<NodeId, QPointF>> run(const std::vector<NodeId>& roots);
+
+  private:
+    enum Flag
+    {
+      Affected = 1,
+      Root = 2,
+      Done = 4,
+      Moving = 8
+    };
+
+    LayoutCache::Scratch& visit(NodeId node);
+    quint32 layer(NodeId node, const QRectF& box) const;
+    qreal column(quint32 layer, qreal width) const;
+    bool closesLoop(NodeId node);
+
+    const DialogueGraph& graph;
+    const SpatialGrid& grid;
+    LayoutCache& cache;
+};
+
+#endif // LAYOUT_HPP
@@ -5,6 +5,10 @@ int main(int argc, char *argv[])
 {
   QApplication a(argc, argv);
   MainWindow w;
+  if (a.arguments().contains("--opengl"))
+  {
+    w.setAccelerated(true);
+  }
   w.show();
   return a.exec();
 }
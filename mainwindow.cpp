@@ -1,6 +1,14 @@
 #include "mainwindow.hpp"
 #include "nodes.hpp"
 #include "commands.hpp"
+#include "edges.hpp"
+#include "edgerenderer.hpp"
+#include "pool.hpp"
+#include "analysis.hpp"
+#include "jobs.hpp"
+#include "profiler.hpp"
+#include "projectfile.hpp"
+#include "simulator.hpp"
 #include <iostream>
 #include <QMouseEvent>
 #include <QDockWidget>
@@ -9,13 +17,39 @@
 #include <QMenu>
 #include <QMimeData>
 #include <QDrag>
+#include <QFileDialog>
+#include <QMessageBox>
+#include <QStatusBar>
+#include <QLabel>
+#include <QInputDialog>
+#include <QTreeWidget>
+#include <QProgressBar>
+#include <QToolButton>
+#include <QRubberBand>
+#include <algorithm>
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+#ifndef QT_NO_OPENGL
+#include <QOpenGLContext>
+#include <QOpenGLWidget>
+#endif
 
 DialogueView::DialogueView(QGraphicsScene* scene, MainWindow* parent)
   : QGraphicsView(scene, parent)
+  , edgeRouter(new EdgeRouter(this))
+  , edgeRenderer(0)
+  , mediumDetailScale(.35f)
+  , fullDetailScale(.7f)
+  , movingNodes(false)
+  , rubberBand(0)
+  , overlayVisible(false)
+  , frames(0)
+  , framesPerSecond(0)
+  , itemCount(0)
 {
   setMinimumSize(640, 480);
   setViewportUpdateMode(QGraphicsView::SmartViewportUpdate);
-  setDragMode(QGraphicsView::RubberBandDrag);
+  setDragMode(QGraphicsView::NoDrag);
   setAlignment(Qt::AlignLeft | Qt::AlignTop);
   setTransformationAnchor(QGraphicsView::NoAnchor);
   setResizeAnchor(QGraphicsView::NoAnchor);
@@ -23,6 +57,270 @@ DialogueView::DialogueView(QGraphicsScene* scene, MainWindow* parent)
   setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
 }
 
+DialogueView::~DialogueView()
+{
+#ifndef QT_NO_OPENGL
+  delete edgeRenderer;
+  edgeRenderer = 0;
+#endif
+}
+
+DialogueView::DetailLevel DialogueView::detailLevel(qreal levelOfDetail) const
+{
+  if (levelOfDetail >= fullDetailScale)
+  {
+    return FullDetail;
+  }
+  return levelOfDetail >= mediumDetailScale ? MediumDetail : LowDetail;
+}
+
+void DialogueView::setDetailThresholds(qreal medium, qreal full)
+{
+  mediumDetailScale = medium;
+  fullDetailScale = full;
+  viewport()->update();
+}
+
+bool DialogueView::setAccelerated(bool accelerated)
+{
+  // The raster viewport stays the fallback when no context can be created
+  if (accelerated == isAccelerated())
+  {
+    return true;
+  }
+#ifndef QT_NO_OPENGL
+  if (accelerated)
+  {
+    QOpenGLContext probe;
+    if (!probe.create())
+    {
+      return false;
+    }
+    QOpenGLWidget* widget = new QOpenGLWidget();
+    QSurfaceFormat format;
+    format.setSamples(4);
+    widget->setFormat(format);
+    setViewport(widget);
+    edgeRenderer = new EdgeRenderer(this, widget);
+    setViewportUpdateMode(QGraphicsView::FullViewportUpdate);
+  }
+  else
+  {
+    delete edgeRenderer;
+    edgeRenderer = 0;
+    setViewport(new QWidget());
+    setViewportUpdateMode(overlayVisible ? QGraphicsView::FullViewportUpdate : QGraphicsView::SmartViewportUpdate);
+  }
+  return true;
+#else
+  return !accelerated;
+#endif
+}
+
+bool DialogueView::isAccelerated() const
+{
+  return edgeRenderer != 0;
+}
+
+void DialogueView::invalidateEdges()
+{
+#ifndef QT_NO_OPENGL
+  if (edgeRenderer)
+  {
+    edgeRenderer->invalidate();
+  }
+#endif
+}
+
+void DialogueView::setOverlayVisible(bool visible)
+{
+  // The overlay sits in a corner that partial updates would leave stale
+  overlayVisible = visible;
+  frames = 0;
+  frameClock.start();
+  if (!isAccelerated())
+  {
+    setViewportUpdateMode(visible ? QGraphicsView::FullViewportUpdate : QGraphicsView::SmartViewportUpdate);
+  }
+  viewport()->update();
+}
+
+DialogueGraph* DialogueView::graph()
+{
+  return &nodeGraph;
+}
+
+SlabPool& DialogueView::itemPool()
+{
+  return pool;
+}
+
+EdgeRouter* DialogueView::router()
+{
+  return edgeRouter;
+}
+
+SpatialGrid& DialogueView::spatialIndex()
+{
+  return grid;
+}
+
+Node* DialogueView::nodeItem(NodeId id) const
+{
+  return id < nodeItems.size() ? nodeItems[id] : 0;
+}
+
+void DialogueView::setNodeItem(NodeId id, Node* node)
+{
+  if (id >= nodeItems.size())
+  {
+    nodeItems.resize(id + 1, 0);
+  }
+  nodeItems[id] = node;
+}
+
+void DialogueView::moveNodes(const std::vector<Node*>& nodes, const std::vector<QPointF>& positions)
+{
+  // Per-item position notifications are muted while moving, then connections
+  // are rerouted in one pass. Large batches also drop the BSP index and
+  // rebuild it once rather than reindexing item by item.
+  const bool rebuildIndex = nodes.size() > 256 && scene()->itemIndexMethod() == QGraphicsScene::BspTreeIndex;
+  if (rebuildIndex)
+  {
+    scene()->setItemIndexMethod(QGraphicsScene::NoIndex);
+  }
+  movingNodes = true;
+  for (size_t i = 0; i < nodes.size(); i++)
+  {
+    nodes[i]->setPos(positions[i]);
+    nodeGraph.setPosition(nodes[i]->id(), positions[i]);
+  }
+  movingNodes = false;
+  for (auto node : nodes)
+  {
+    grid.update(node->id(), node->sceneBoundingRect());
+    edgeRouter->nodeMoved(node);
+  }
+  edgeRouter->flush();
+  if (rebuildIndex)
+  {
+    scene()->setItemIndexMethod(QGraphicsScene::BspTreeIndex);
+  }
+  qobject_cast<MainWindow*>(parent())->updateSceneRect();
+}
+
+bool DialogueView::isMovingNodes() const
+{
+  return movingNodes;
+}
+
+const std::vector<Node*>& DialogueView::selectedNodes() const
+{
+  return selection;
+}
+
+void DialogueView::nodeSelectionChanged(Node* node, bool selected)
+{
+  // Each node remembers its slot, so both ways are constant time
+  if (selected && node->selectionIndex < 0)
+  {
+    node->selectionIndex = int(selection.size());
+    selection.push_back(node);
+  }
+  else if (!selected && node->selectionIndex >= 0)
+  {
+    Node* last = selection.back();
+    selection[node->selectionIndex] = last;
+    last->selectionIndex = node->selectionIndex;
+    selection.pop_back();
+    node->selectionIndex = -1;
+  }
+}
+
+void DialogueView::beginDrag(const QPointF& scenePos)
+{
+  // Connections with both ends in the selection move along with their
+  // source, so only those crossing its border are rerouted while dragging
+  dragged.clear();
+  dragStart.clear();
+  dragBoundary.clear();
+  dragOrigin = scenePos;
+  std::vector<bool> inside(nodeGraph.nodeCount(), false);
+  for (auto node : selection)
+  {
+    if (node->movable())
+    {
+      dragged.push_back(node);
+      dragStart.push_back(node->pos());
+      inside[node->id()] = true;
+    }
+  }
+  for (auto node : dragged)
+  {
+    for (auto& connection : node->connections)
+    {
+      NodeId target = nodeGraph.edgeTarget(connection->edge());
+      if (target != NoId && !inside[target])
+      {
+        dragBoundary.push_back(connection.get());
+      }
+    }
+    for (EdgeId edge = nodeGraph.firstIncoming(node->id()); edge != NoId; edge = nodeGraph.nextIncoming(edge))
+    {
+      Node* source = nodeItem(nodeGraph.edgeSource(edge));
+      if (source && !inside[source->id()])
+      {
+        dragBoundary.push_back(source->connections[nodeGraph.edgeSlot(edge)].get());
+      }
+    }
+  }
+}
+
+void DialogueView::dragTo(const QPointF& scenePos)
+{
+  // The whole group shares one offset and is placed in a single muted pass
+  QPointF offset = scenePos - dragOrigin;
+  movingNodes = true;
+  for (size_t i = 0; i < dragged.size(); i++)
+  {
+    dragged[i]->setPos(dragStart[i] + offset);
+  }
+  movingNodes = false;
+  for (auto node : dragged)
+  {
+    grid.update(node->id(), node->sceneBoundingRect());
+  }
+  for (auto connection : dragBoundary)
+  {
+    edgeRouter->markDirty(connection);
+  }
+  invalidateEdges();
+}
+
+void DialogueView::endDrag()
+{
+  std::vector<MoveCommand::Movement> movements;
+  for (size_t i = 0; i < dragged.size(); i++)
+  {
+    if (dragged[i]->pos() != dragStart[i])
+    {
+      movements.push_back(MoveCommand::Movement{dragged[i], dragStart[i], dragged[i]->pos()});
+    }
+  }
+  dragged.clear();
+  dragStart.clear();
+  dragBoundary.clear();
+  if (!movements.empty())
+  {
+    nodeMoveEvent(new MoveCommand(std::move(movements)));
+  }
+}
+
+bool DialogueView::isDragging() const
+{
+  return !dragged.empty();
+}
+
 Node* DialogueView::dragConnection(Node* node)
 {
   nodeConnectionFrom = node;
@@ -63,6 +361,11 @@ void DialogueView::nodeConnectEvent(ConnectCommand* connection)
   emit(nodeConnected(connection));
 }
 
+void DialogueView::nodeTextEvent(Node* node)
+{
+  emit(nodeTextRequested(node));
+}
+
 void DialogueView::mousePressEvent(QMouseEvent* event)
 {
   if (event->button() == Qt::RightButton)
@@ -71,19 +374,71 @@ void DialogueView::mousePressEvent(QMouseEvent* event)
     setDragMode(QGraphicsView::ScrollHandDrag);
     QGraphicsView::mousePressEvent(&fake);
   }
+  else if (event->button() == Qt::LeftButton && grid.at(mapToScene(event->pos())) == NoId)
+  {
+    // Presses on empty canvas start a rubber band that selects through the
+    // grid instead of the scene's own index
+    if (!(event->modifiers() & Qt::ControlModifier))
+    {
+      scene()->clearSelection();
+    }
+    if (!rubberBand)
+    {
+      rubberBand = new QRubberBand(QRubberBand::Rectangle, viewport());
+    }
+    bandOrigin = event->pos();
+    banded.clear();
+    rubberBand->setGeometry(QRect(bandOrigin, QSize()));
+    rubberBand->show();
+  }
   else
   {
     QGraphicsView::mousePressEvent(event);
   }
 }
 
+void DialogueView::mouseMoveEvent(QMouseEvent* event)
+{
+  if (!rubberBand || !rubberBand->isVisible())
+  {
+    QGraphicsView::mouseMoveEvent(event);
+    return;
+  }
+  QRect area = QRect(bandOrigin, event->pos()).normalized();
+  rubberBand->setGeometry(area);
+  std::vector<NodeId> hits = grid.query(mapToScene(area).boundingRect());
+  std::sort(hits.begin(), hits.end());
+  for (auto id : banded)
+  {
+    Node* node = nodeItem(id);
+    if (node && !std::binary_search(hits.begin(), hits.end(), id))
+    {
+      node->setSelected(false);
+    }
+  }
+  for (auto id : hits)
+  {
+    Node* node = nodeItem(id);
+    if (node && !std::binary_search(banded.begin(), banded.end(), id))
+    {
+      node->setSelected(true);
+    }
+  }
+  banded.swap(hits);
+}
+
 void DialogueView::mouseReleaseEvent(QMouseEvent* event)
 {
   if (event->button() == Qt::RightButton)
   {
     QMouseEvent fake(event->type(), event->pos(), Qt::LeftButton, Qt::LeftButton, event->modifiers());
     QGraphicsView::mouseReleaseEvent(&fake);
-    setDragMode(QGraphicsView::RubberBandDrag);
+    setDragMode(QGraphicsView::NoDrag);
+  }
+  else if (rubberBand && rubberBand->isVisible())
+  {
+    rubberBand->hide();
+    banded.clear();
   }
   else
   {
@@ -98,41 +453,107 @@ void DialogueView::resizeEvent(QResizeEvent* event)
   QGraphicsView::resizeEvent(event);
 }
 
+void DialogueView::drawBackground(QPainter* painter, const QRectF& rect)
+{
+  QGraphicsView::drawBackground(painter, rect);
+#ifndef QT_NO_OPENGL
+  if (edgeRenderer)
+  {
+    qreal lod = QStyleOptionGraphicsItem::levelOfDetailFromTransform(painter->worldTransform());
+    painter->beginNativePainting();
+    edgeRenderer->draw(painter->worldTransform(), viewport()->size(), detailLevel(lod) == LowDetail);
+    painter->endNativePainting();
+  }
+#endif
+}
+
+void DialogueView::drawForeground(QPainter* painter, const QRectF& rect)
+{
+  QGraphicsView::drawForeground(painter, rect);
+#ifdef DIALOGUENODE_PROFILE
+  Profiler::frame();
+  if (!overlayVisible)
+  {
+    return;
+  }
+  frames++;
+  if (frameClock.elapsed() >= 1000)
+  {
+    framesPerSecond = frames * 1000.f / frameClock.restart();
+    frames = 0;
+    itemCount = scene()->items().size();
+  }
+
+  QStringList lines;
+  lines << tr("%1 fps, %2 items").arg(framesPerSecond, 0, 'f', 1).arg(itemCount);
+  for (auto site : Profiler::sites())
+  {
+    lines << tr("%1: %2 calls, %3 ms").arg(site->name).arg(site->frameCalls).arg(site->frameNanoseconds / 1e6, 0, 'f', 2);
+  }
+
+  painter->save();
+  painter->resetTransform();
+  painter->setRenderHint(QPainter::Antialiasing, false);
+  QString text = lines.join('\n');
+  QRectF box = painter->boundingRect(QRectF(8, 8, 1000, 1000), Qt::AlignLeft | Qt::AlignTop, text);
+  painter->fillRect(box.marginsAdded(QMarginsF(4, 4, 4, 4)), QColor(0, 0, 0, 160));
+  painter->setPen(Qt::white);
+  painter->drawText(box, Qt::AlignLeft | Qt::AlignTop, text);
+  painter->restore();
+#else
+  Q_UNUSED(painter);
+  Q_UNUSED(rect);
+#endif
+}
+
 MainWindow::MainWindow(QWidget *parent)
   : QMainWindow(parent)
+  , historyBudget(64 * 1024 * 1024)
+  , spillCursor(0)
+  , trimCursor(0)
+  , reportCurrent(false)
 {
   undoStack = new QUndoStack(this);
+  history = new HistoryLedger(undoStack);
+  jobs = new JobQueue(this);
+  connect(undoStack, SIGNAL(indexChanged(int)), this, SLOT(historyChanged()));
 
   createActions();
   createMenus();
   createDocks();
+  createStatusBar();
 
   scene = new QGraphicsScene(this);
 
   view = new DialogueView(scene, this);
   connect(view, SIGNAL(nodeMoved(MoveCommand*)), this, SLOT(nodeMoved(MoveCommand*)));
   connect(view, SIGNAL(nodeConnected(ConnectCommand*)), this, SLOT(nodeConnected(ConnectCommand*)));
+  connect(view, SIGNAL(nodeTextRequested(Node*)), this, SLOT(editText(Node*)));
   setCentralWidget(view);
+  createSimulator();
 
-  auto node0 = new TextNode(view);
+  auto node0 = new (view->itemPool()) Node(view, TextKind);
   node0->setPos(50, 60);
   scene->addItem(node0);
 
-  auto node1 = new TextNode(view);
+  auto node1 = new (view->itemPool()) Node(view, TextKind);
   node1->setPos(300, 60);
   node0->setConnection(0, node1);
   scene->addItem(node1);
 
-  auto node2 = new TextNode(view);
+  auto node2 = new (view->itemPool()) Node(view, TextKind);
   node2->setPos(500, 60);
   node1->setConnection(0, node2);
   scene->addItem(node2);
 
-  auto node3 = new TextNode(view);
+  auto node3 = new (view->itemPool()) Node(view, TextKind);
   node3->setPos(300, 200);
   node3->setConnection(0, node2);
   scene->addItem(node3);
 
+  connect(undoStack, SIGNAL(indexChanged(int)), this, SLOT(analyseGraph()));
+  connect(undoStack, SIGNAL(indexChanged(int)), this, SLOT(cancelLayout()));
+  analyseGraph();
   updateSceneRect();
 }
 
@@ -162,10 +583,45 @@ void MainWindow::createActions()
   connect(deleteAction, SIGNAL(triggered()), this, SLOT(deleteItem()));
 
   deleteLooseAction = new QAction(tr("Delete &Loose Nodes"), this);
-  connect(deleteLooseAction, SIGNAL(triggered()), this, SLOT(deleteItem()));
+  connect(deleteLooseAction, SIGNAL(triggered()), this, SLOT(deleteLoose()));
+
+  layoutAction = new QAction(tr("Auto &Layout"), this);
+  layoutAction->setShortcut(Qt::CTRL + Qt::Key_L);
+  connect(layoutAction, SIGNAL(triggered()), this, SLOT(autoLayout()));
+
+  pinAction = new QAction(tr("&Pin Nodes"), this);
+  pinAction->setShortcut(Qt::CTRL + Qt::Key_P);
+  connect(pinAction, SIGNAL(triggered()), this, SLOT(togglePin()));
+
+  textAction = new QAction(tr("Edit &Text"), this);
+  textAction->setShortcut(Qt::Key_F2);
+  connect(textAction, SIGNAL(triggered()), this, SLOT(editText()));
+
+  openGLAction = new QAction(tr("Use &OpenGL"), this);
+  openGLAction->setCheckable(true);
+  connect(openGLAction, SIGNAL(toggled(bool)), this, SLOT(toggleAcceleration(bool)));
+
+#ifdef DIALOGUENODE_PROFILE
+  overlayAction = new QAction(tr("Performance &Overlay"), this);
+  overlayAction->setCheckable(true);
+  overlayAction->setShortcut(Qt::Key_F12);
+  connect(overlayAction, SIGNAL(toggled(bool)), this, SLOT(toggleOverlay(bool)));
 
-  addTextNodeAction = new QAction(tr("Add &Text Node"), this);
-  connect(addTextNodeAction, SIGNAL(triggered()), this, SLOT(addTextNode()));
+  traceAction = new QAction(tr("Record &Trace"), this);
+  traceAction->setCheckable(true);
+  connect(traceAction, SIGNAL(toggled(bool)), this, SLOT(toggleTrace(bool)));
+#endif
+
+  playAction = new QAction(tr("&Play from Here"), this);
+  playAction->setShortcut(Qt::Key_F5);
+  connect(playAction, SIGNAL(triggered()), this, SLOT(playFromHere()));
+
+  for (int kind = 0; kind < KindCount; kind++)
+  {
+    addNodeActions[kind] = new QAction(kindInfo(NodeKind(kind)).name(), this);
+    addNodeActions[kind]->setData(kind);
+    connect(addNodeActions[kind], SIGNAL(triggered()), this, SLOT(addNode()));
+  }
 
   undoAction = undoStack->createUndoAction(this, tr("&Undo"));
   undoAction->setShortcuts(QKeySequence::Undo);
@@ -189,8 +645,27 @@ void MainWindow::createMenus()
   editMenu->addAction(undoAction);
   editMenu->addAction(redoAction);
   editMenu->addSeparator();
+  editMenu->addAction(textAction);
   editMenu->addAction(deleteAction);
   editMenu->addAction(deleteLooseAction);
+  editMenu->addSeparator();
+  addMenu = editMenu->addMenu(tr("&Add Node"));
+  for (auto action : addNodeActions)
+  {
+    addMenu->addAction(action);
+  }
+  editMenu->addSeparator();
+  editMenu->addAction(layoutAction);
+  editMenu->addAction(pinAction);
+  editMenu->addAction(playAction);
+
+  viewMenu = menuBar()->addMenu(tr("&View"));
+  viewMenu->addAction(openGLAction);
+#ifdef DIALOGUENODE_PROFILE
+  viewMenu->addSeparator();
+  viewMenu->addAction(overlayAction);
+  viewMenu->addAction(traceAction);
+#endif
 }
 
 void MainWindow::createDocks()
@@ -199,6 +674,10 @@ void MainWindow::createDocks()
   overviewWidget->setAllowedAreas(Qt::LeftDockWidgetArea | Qt::RightDockWidgetArea);
   overviewWidget->setMinimumWidth(200);
   overviewWidget->setFeatures(QDockWidget::DockWidgetMovable);
+  overviewTree = new QTreeWidget(overviewWidget);
+  overviewTree->setHeaderHidden(true);
+  connect(overviewTree, SIGNAL(itemActivated(QTreeWidgetItem*,int)), this, SLOT(overviewActivated(QTreeWidgetItem*)));
+  overviewWidget->setWidget(overviewTree);
   addDockWidget(Qt::RightDockWidgetArea, overviewWidget);
 
   propertiesWidget = new QDockWidget(tr("Properties"), this);
@@ -208,16 +687,211 @@ void MainWindow::createDocks()
   addDockWidget(Qt::RightDockWidgetArea, propertiesWidget);
 }
 
-void MainWindow::addTextNode()
+void MainWindow::createSimulator()
+{
+  simulatorWidget = new QDockWidget(tr("Simulator"), this);
+  simulatorWidget->setAllowedAreas(Qt::LeftDockWidgetArea | Qt::RightDockWidgetArea | Qt::BottomDockWidgetArea);
+  simulatorWidget->setMinimumWidth(200);
+  simulatorWidget->setFeatures(QDockWidget::DockWidgetMovable);
+  simulator = new Simulator(view, simulatorWidget);
+  simulatorWidget->setWidget(simulator);
+  addDockWidget(Qt::RightDockWidgetArea, simulatorWidget);
+
+  // The compiled script is a snapshot, any edit ends the playthrough
+  connect(undoStack, SIGNAL(indexChanged(int)), simulator, SLOT(stop()));
+}
+
+void MainWindow::createStatusBar()
+{
+  historyLabel = new QLabel(this);
+  statusBar()->addPermanentWidget(historyLabel);
+  historyChanged();
+
+  jobProgress = new QProgressBar(this);
+  jobProgress->setRange(0, 100);
+  jobProgress->setMaximumWidth(150);
+  jobProgress->hide();
+  cancelJobsButton = new QToolButton(this);
+  cancelJobsButton->setText(tr("Cancel"));
+  cancelJobsButton->hide();
+  statusBar()->addPermanentWidget(jobProgress);
+  statusBar()->addPermanentWidget(cancelJobsButton);
+  connect(jobs, SIGNAL(progressChanged(int)), jobProgress, SLOT(setValue(int)));
+  connect(jobs, SIGNAL(busyChanged(bool)), jobProgress, SLOT(setVisible(bool)));
+  connect(jobs, SIGNAL(busyChanged(bool)), cancelJobsButton, SLOT(setVisible(bool)));
+  connect(cancelJobsButton, SIGNAL(clicked()), jobs, SLOT(cancelAll()));
+}
+
+void MainWindow::setHistoryBudget(qint64 bytes)
+{
+  historyBudget = bytes;
+  historyChanged();
+}
+
+// Spills the command, or the commands inside a macro, until the history fits
+static void spillCommand(const QUndoCommand* command, HistoryLedger* history, qint64 budget)
+{
+  auto historyCommand = const_cast<HistoryCommand*>(dynamic_cast<const HistoryCommand*>(command));
+  if (historyCommand)
+  {
+    historyCommand->spill(history->file());
+  }
+  for (int i = 0; history->memoryUsage() > budget && i < command->childCount(); i++)
+  {
+    spillCommand(command->child(i), history, budget);
+  }
+}
+
+// Trims the command, or the commands inside a macro, until the history fits
+static void trimCommand(const QUndoCommand* command, HistoryLedger* history, qint64 budget)
+{
+  auto historyCommand = const_cast<HistoryCommand*>(dynamic_cast<const HistoryCommand*>(command));
+  if (historyCommand)
+  {
+    historyCommand->trim();
+  }
+  for (int i = 0; history->memoryUsage() > budget && i < command->childCount(); i++)
+  {
+    trimCommand(command->child(i), history, budget);
+  }
+}
+
+void MainWindow::historyChanged()
+{
+  // Only a newly pushed command is unknown to the ledger, every other one
+  // reports its own changes
+  if (undoStack->count() > 0)
+  {
+    HistoryCommand::track(undoStack->command(undoStack->count() - 1), history);
+  }
+
+  // Oldest commands are spilled first, the file is only created when needed.
+  // Each command is looked at once; undo and redo read spilled commands
+  // back at the current index, so the walk resumes from there at the latest.
+  spillCursor = qMin(spillCursor, undoStack->index());
+  if (history->memoryUsage() > historyBudget && history->file())
+  {
+    while (history->memoryUsage() > historyBudget && spillCursor < undoStack->count())
+    {
+      spillCommand(undoStack->command(spillCursor), history, historyBudget);
+      if (history->memoryUsage() > historyBudget)
+      {
+        spillCursor++;
+      }
+    }
+  }
+
+  // Qt only limits a stack while it is empty, so when spilling is not
+  // enough the oldest done commands are trimmed instead, keeping the last
+  // edit undoable. Trimming is for good, so that cursor only moves on.
+  trimCursor = qMin(trimCursor, undoStack->count());
+  while (history->memoryUsage() > historyBudget && trimCursor < undoStack->index() - 1)
+  {
+    trimCommand(undoStack->command(trimCursor), history, historyBudget);
+    if (history->memoryUsage() > historyBudget)
+    {
+      trimCursor++;
+    }
+  }
+
+  QString text = tr("History: %1 KiB").arg((history->memoryUsage() + 1023) / 1024);
+  if (history->diskUsage() > 0)
+  {
+    text += tr(" (%1 KiB on disk)").arg((history->diskUsage() + 1023) / 1024);
+  }
+  historyLabel->setText(text);
+}
+
+void MainWindow::setAccelerated(bool accelerated)
+{
+  openGLAction->setChecked(accelerated);
+}
+
+void MainWindow::toggleAcceleration(bool accelerated)
+{
+  if (!view->setAccelerated(accelerated))
+  {
+    openGLAction->setChecked(false);
+    statusBar()->showMessage(tr("OpenGL is not available, using the raster viewport"), 5000);
+  }
+}
+
+void MainWindow::toggleOverlay(bool visible)
 {
+  view->setOverlayVisible(visible);
+}
+
+void MainWindow::toggleTrace(bool recording)
+{
+#ifdef DIALOGUENODE_PROFILE
+  if (recording)
+  {
+    Profiler::startTrace();
+    return;
+  }
+  QString name = QFileDialog::getSaveFileName(this, tr("Save Trace"), QString(), tr("Trace Events (*.json)"));
+  if (name.isEmpty())
+  {
+    Profiler::discardTrace();
+  }
+  else if (!Profiler::stopTrace(name))
+  {
+    QMessageBox::warning(this, tr("Save Trace"), tr("Cannot write %1.").arg(name));
+  }
+#else
+  Q_UNUSED(recording);
+#endif
+}
+
+void MainWindow::addNode()
+{
+  QAction* action = qobject_cast<QAction*>(sender());
+  if (!action)
+  {
+    return;
+  }
+  NodeKind kind = NodeKind(action->data().toInt());
+  Node* node = new (view->itemPool()) Node(view, kind);
+  layoutCache.forget(node->id());
+  node->setPos(view->mapToScene(view->viewport()->rect().center()));
+  scene->addItem(node);
+  scene->clearSelection();
+  node->setSelected(true);
+  AddCommand* command = new AddCommand(node);
+  command->setText(tr("Add %1 Node").arg(kindInfo(kind).name()));
+  undoStack->push(command);
+  updateSceneRect();
 }
 
 void MainWindow::deleteItem()
 {
+  std::vector<Node*> nodes = view->selectedNodes();
+  if (!nodes.empty())
+  {
+    std::vector<NodeId> targets = targetsOf(nodes);
+    // The nodes come back in their old places with a single undo
+    undoStack->beginMacro(tr("Delete Nodes"));
+    undoStack->push(new DeleteCommand(nodes));
+    relayout(targets);
+    undoStack->endMacro();
+  }
+}
+
+void MainWindow::deleteLoose()
+{
+  // The background report is reused when it matches the document
+  if (!reportCurrent)
+  {
+    lastReport = GraphAnalysis(*view->graph()).run();
+    reportCurrent = true;
+  }
+  // Only nodes with no connections either way go; unreachable ones can
+  // still be the start of something the writer is working on. Loose nodes
+  // lead nowhere, so nothing needs to be laid out again.
   std::vector<Node*> nodes;
-  for (auto& item : scene->selectedItems())
+  for (auto id : lastReport.loose)
   {
-    Node* node = dynamic_cast<Node*>(item);
+    Node* node = view->nodeItem(id);
     if (node)
     {
       nodes.push_back(node);
@@ -229,6 +903,296 @@ void MainWindow::deleteItem()
   }
 }
 
+void MainWindow::autoLayout()
+{
+  cancelLayout();
+  DialogueGraph* graph = view->graph();
+  std::vector<QSizeF> sizes(graph->nodeCount());
+  for (NodeId id = 0; id < graph->nodeCount(); id++)
+  {
+    Node* node = view->nodeItem(id);
+    if (node)
+    {
+      sizes[id] = node->boundingRect().size();
+    }
+  }
+  layoutJob = new LayoutJob(*graph, std::move(sizes));
+  connect(layoutJob, SIGNAL(finished()), this, SLOT(layoutReady()));
+  jobs->start(layoutJob);
+}
+
+void MainWindow::layoutReady()
+{
+  if (sender() != layoutJob.data())
+  {
+    return;
+  }
+
+  // The layout keeps the top left corner of the document where it was
+  DialogueGraph* graph = view->graph();
+  const std::vector<QPointF>& positions = layoutJob->positions();
+  std::vector<Node*> nodes;
+  QPointF origin;
+  for (NodeId id = 0; id < positions.size(); id++)
+  {
+    Node* node = view->nodeItem(id);
+    if (node)
+    {
+      QPointF corner = node->pos() + node->boundingRect().topLeft();
+      if (nodes.empty())
+      {
+        origin = corner;
+      }
+      origin = QPointF(qMin(origin.x(), corner.x()), qMin(origin.y(), corner.y()));
+      nodes.push_back(node);
+    }
+  }
+
+  layoutCache = layoutJob->cache();
+  for (auto& column : layoutCache.columns)
+  {
+    column += origin.x();
+  }
+
+  std::vector<MoveCommand::Movement> movements;
+  for (auto node : nodes)
+  {
+    if (graph->isPinned(node->id()))
+    {
+      continue;
+    }
+    QPointF pos = origin + positions[node->id()] - node->boundingRect().topLeft();
+    if (pos != node->pos())
+    {
+      movements.push_back(MoveCommand::Movement{node, node->pos(), pos});
+    }
+  }
+  if (!movements.empty())
+  {
+    MoveCommand* command = new MoveCommand(std::move(movements));
+    command->setText(tr("Auto Layout"));
+    undoStack->push(command);
+  }
+}
+
+void MainWindow::togglePin()
+{
+  // Mixed selections are pinned first, a second press releases them
+  const std::vector<Node*>& nodes = view->selectedNodes();
+  bool pinned = true;
+  for (auto node : nodes)
+  {
+    pinned = pinned && view->graph()->isPinned(node->id());
+  }
+  if (!nodes.empty())
+  {
+    PinCommand* command = new PinCommand(nodes, !pinned);
+    command->setText(pinned ? tr("Unpin Nodes") : tr("Pin Nodes"));
+    undoStack->push(command);
+  }
+}
+
+std::vector<NodeId> MainWindow::targetsOf(const std::vector<Node*>& nodes) const
+{
+  DialogueGraph* graph = view->graph();
+  std::vector<NodeId> targets;
+  for (auto node : nodes)
+  {
+    for (quint32 slot = 0; slot < graph->edgeCount(node->id()); slot++)
+    {
+      NodeId target = graph->edgeTarget(graph->edge(node->id(), slot));
+      if (target != NoId)
+      {
+        targets.push_back(target);
+      }
+    }
+  }
+  return targets;
+}
+
+// Pushes the layout that follows an edit. Callers push both inside one
+// macro, so undo never stops between the edit and its layout.
+void MainWindow::relayout(const std::vector<NodeId>& roots)
+{
+  // Only documents that have been laid out once get re-placed on edits
+  if (layoutCache.isEmpty())
+  {
+    return;
+  }
+  DialogueGraph* graph = view->graph();
+  std::vector<NodeId> alive;
+  for (auto id : roots)
+  {
+    if (graph->isAlive(id))
+    {
+      alive.push_back(id);
+    }
+  }
+  if (alive.empty())
+  {
+    return;
+  }
+
+  std::vector<MoveCommand::Movement> movements;
+  for (auto& placed : LocalLayout(*graph, view->spatialIndex(), layoutCache).run(alive))
+  {
+    Node* node = view->nodeItem(placed.first);
+    QPointF pos = placed.second - node->boundingRect().topLeft();
+    if (pos != node->pos())
+    {
+      movements.push_back(MoveCommand::Movement{node, node->pos(), pos});
+    }
+  }
+  if (!movements.empty())
+  {
+    MoveCommand* command = new MoveCommand(std::move(movements));
+    command->setText(tr("Auto Layout"));
+    undoStack->push(command);
+  }
+}
+
+void MainWindow::cancelLayout()
+{
+  if (layoutJob)
+  {
+    layoutJob->cancel();
+  }
+}
+
+void MainWindow::analyseGraph()
+{
+  // Edits restart the analysis on a fresh snapshot, a stale one is dropped
+  if (analysisJob)
+  {
+    analysisJob->cancel();
+  }
+  reportCurrent = false;
+  analysisJob = new AnalysisJob(*view->graph());
+  connect(analysisJob, SIGNAL(finished()), this, SLOT(reportReady()));
+  jobs->start(analysisJob);
+}
+
+void MainWindow::reportReady()
+{
+  if (sender() != analysisJob.data())
+  {
+    return;
+  }
+  DialogueGraph* graph = view->graph();
+  lastReport = analysisJob->report();
+  reportCurrent = true;
+  const GraphReport& report = lastReport;
+
+  // Children carry the node they point at, activating one jumps to it
+  auto addNode = [&](QTreeWidgetItem* group, NodeId node, const QString& detail)
+  {
+    QString text = graph->textId(node) == EmptyString ? tr("Node %1").arg(node) : graph->text(node);
+    QTreeWidgetItem* item = new QTreeWidgetItem(group, QStringList(detail.isEmpty() ? text : tr("%1: %2").arg(text, detail)));
+    item->setData(0, Qt::UserRole, node);
+  };
+
+  overviewTree->clear();
+  QTreeWidgetItem* summary = new QTreeWidgetItem(overviewTree, QStringList(tr("%n node(s)", 0, int(graph->aliveCount()))));
+  for (auto node : report.roots)
+  {
+    if (!std::binary_search(report.loose.begin(), report.loose.end(), node))
+    {
+      addNode(summary, node, tr("start"));
+    }
+  }
+  if (report.isClean())
+  {
+    new QTreeWidgetItem(overviewTree, QStringList(tr("No problems found")));
+  }
+  if (!report.loose.empty())
+  {
+    QTreeWidgetItem* group = new QTreeWidgetItem(overviewTree, QStringList(tr("Loose nodes (%1)").arg(report.loose.size())));
+    for (auto node : report.loose)
+    {
+      addNode(group, node, QString());
+    }
+  }
+  if (!report.unreachable.empty())
+  {
+    QTreeWidgetItem* group = new QTreeWidgetItem(overviewTree, QStringList(tr("Unreachable nodes (%1)").arg(report.unreachable.size())));
+    for (auto node : report.unreachable)
+    {
+      addNode(group, node, QString());
+    }
+  }
+  if (!report.dangling.empty())
+  {
+    QTreeWidgetItem* group = new QTreeWidgetItem(overviewTree, QStringList(tr("Unconnected choices (%1)").arg(report.dangling.size())));
+    for (auto edge : report.dangling)
+    {
+      addNode(group, graph->edgeSource(edge), graph->edgeName(edge));
+    }
+  }
+  if (!report.trappedCycles.empty())
+  {
+    QTreeWidgetItem* group = new QTreeWidgetItem(overviewTree, QStringList(tr("Loops without exit (%1)").arg(report.trappedCycles.size())));
+    for (auto& cycle : report.trappedCycles)
+    {
+      QTreeWidgetItem* loop = new QTreeWidgetItem(group, QStringList(tr("%n node(s)", 0, int(cycle.size()))));
+      for (auto node : cycle)
+      {
+        addNode(loop, node, QString());
+      }
+    }
+  }
+  overviewTree->expandToDepth(0);
+  deleteLooseAction->setEnabled(report.hasLoose());
+}
+
+void MainWindow::overviewActivated(QTreeWidgetItem* item)
+{
+  QVariant data = item->data(0, Qt::UserRole);
+  Node* node = data.isValid() ? view->nodeItem(NodeId(data.toUInt())) : 0;
+  if (node)
+  {
+    scene->clearSelection();
+    node->setSelected(true);
+    view->ensureVisible(node);
+  }
+}
+
+void MainWindow::playFromHere()
+{
+  if (!view->selectedNodes().empty())
+  {
+    simulatorWidget->show();
+    simulator->start(view->selectedNodes().front());
+  }
+}
+
+void MainWindow::editText()
+{
+  if (!view->selectedNodes().empty())
+  {
+    editText(view->selectedNodes().front());
+  }
+}
+
+void MainWindow::editText(Node* node)
+{
+  const KindInfo& info = kindInfo(node->kind());
+  if (!info.showsText)
+  {
+    return;
+  }
+  // The dialog runs its own event loop, so the node is found again after
+  NodeId id = node->id();
+  bool ok = false;
+  QString text = QInputDialog::getMultiLineText(this, tr("Edit Text"), info.name(), node->text(), &ok);
+  node = view->nodeItem(id);
+  if (ok && node && text != node->text())
+  {
+    TextCommand* command = new TextCommand(node, text);
+    command->setText(tr("Edit Text"));
+    undoStack->push(command);
+  }
+}
+
 void MainWindow::nodeMoved(MoveCommand* movement)
 {
   undoStack->push(movement);
@@ -236,23 +1200,112 @@ void MainWindow::nodeMoved(MoveCommand* movement)
 
 void MainWindow::nodeConnected(ConnectCommand* connection)
 {
+  // The push may merge the command away, so the target is read first
+  NodeId target = connection->target();
+  if (target == NoId || layoutCache.isEmpty())
+  {
+    // Nothing is laid out again, so repeated connects can still merge
+    undoStack->push(connection);
+    return;
+  }
+  undoStack->beginMacro(tr("Connect"));
   undoStack->push(connection);
+  relayout(std::vector<NodeId>(1, target));
+  undoStack->endMacro();
 }
 
 void MainWindow::open()
 {
+  QString name = QFileDialog::getOpenFileName(this, tr("Open"), QString(), tr("Dialogue Projects (*.dlgn)"));
+  if (name.isEmpty())
+  {
+    return;
+  }
+
+  ProjectFile file(name);
+  DialogueGraph graph;
+  if (!file.load(graph))
+  {
+    QMessageBox::warning(this, tr("Open"), file.errorString());
+    return;
+  }
+
+  simulator->stop();
+  layoutCache.clear();
+  undoStack->clear();
+  scene->clear();
+  *view->graph() = std::move(graph);
+  std::vector<Node*> nodes;
+  for (NodeId id = 0; id < view->graph()->nodeCount(); id++)
+  {
+    if (view->graph()->isAlive(id))
+    {
+      nodes.push_back(new (view->itemPool()) Node(view, id));
+    }
+  }
+  for (auto node : nodes)
+  {
+    node->updatePaths();
+    scene->addItem(node);
+  }
+  fileName = name;
+  analyseGraph();
+  updateSceneRect();
 }
 
 void MainWindow::save()
 {
+  if (fileName.isEmpty())
+  {
+    saveAs();
+  }
+  else
+  {
+    saveFile(fileName);
+  }
 }
 
 void MainWindow::saveAs()
 {
+  QString name = QFileDialog::getSaveFileName(this, tr("Save As"), fileName, tr("Dialogue Projects (*.dlgn)"));
+  if (!name.isEmpty() && saveFile(name))
+  {
+    fileName = name;
+  }
+}
+
+bool MainWindow::saveFile(const QString& name)
+{
+  ProjectFile file(name);
+  if (!file.save(*view->graph()))
+  {
+    QMessageBox::warning(this, tr("Save"), file.errorString());
+    return false;
+  }
+  undoStack->setClean();
+  return true;
 }
 
 void MainWindow::exportFile()
 {
+  QString name = QFileDialog::getSaveFileName(this, tr("Export"), QString(), tr("Dialogue Scripts (*.dlgx)"));
+  if (name.isEmpty())
+  {
+    return;
+  }
+
+  ExportJob* job = new ExportJob(*view->graph(), name);
+  connect(job, SIGNAL(finished()), this, SLOT(exportFinished()));
+  jobs->start(job);
+}
+
+void MainWindow::exportFinished()
+{
+  ExportJob* job = qobject_cast<ExportJob*>(sender());
+  if (job && !job->succeeded())
+  {
+    QMessageBox::warning(this, tr("Export"), job->errorString());
+  }
 }
 
 void MainWindow::quit()
@@ -262,8 +1315,9 @@ void MainWindow::quit()
 
 void MainWindow::updateSceneRect()
 {
+  PROFILE_SCOPE("MainWindow::updateSceneRect");
   QRectF size = view->viewport()->rect();
   size = size.marginsAdded(QMarginsF(0, 0, 200, 0.1));
-  QRectF bounds = scene->itemsBoundingRect().marginsAdded(QMarginsF(50, 50, 200, 50));
+  QRectF bounds = view->spatialIndex().bounds().marginsAdded(QMarginsF(50, 50, 200, 50));
   view->setSceneRect(size.united(bounds));
 }
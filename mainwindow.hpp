@@ -1,17 +1,39 @@
 #ifndef MAINWINDOW_HPP
 #define MAINWINDOW_HPP
 
+#include "graph.hpp"
+#include "analysis.hpp"
+#include "layout.hpp"
+#include "pool.hpp"
+#include "spatialgrid.hpp"
 #include <QGraphicsScene>
 #include <QGraphicsView>
+#include <QElapsedTimer>
 #include <QMainWindow>
+#include <QPointer>
+#include <vector>
 
 class QMenu;
 class QMenuBar;
+class QLabel;
+class QProgressBar;
+class QRubberBand;
+class QToolButton;
 class QDockWidget;
+class QTreeWidget;
+class QTreeWidgetItem;
 class QUndoStack;
 class Node;
+class EdgeRouter;
+class EdgeRenderer;
+class NodeConnection;
 class MoveCommand;
 class ConnectCommand;
+class HistoryLedger;
+class Simulator;
+class JobQueue;
+class AnalysisJob;
+class LayoutJob;
 class MainWindow;
 
 class DialogueView : public QGraphicsView
@@ -19,8 +41,37 @@ class DialogueView : public QGraphicsView
     Q_OBJECT
     friend class Node;
   public:
-    DialogueView(QGraphicsScene* scene, MainWindow* parent);
+    enum DetailLevel
+    {
+      LowDetail,
+      MediumDetail,
+      FullDetail
+    };
 
+    DialogueView(QGraphicsScene* scene, MainWindow* parent);
+    ~DialogueView();
+
+    DetailLevel detailLevel(qreal levelOfDetail) const;
+    void setDetailThresholds(qreal medium, qreal full);
+    bool setAccelerated(bool accelerated);
+    bool isAccelerated() const;
+    void invalidateEdges();
+    void setOverlayVisible(bool visible);
+
+    DialogueGraph* graph();
+    SlabPool& itemPool();
+    EdgeRouter* router();
+    SpatialGrid& spatialIndex();
+    Node* nodeItem(NodeId id) const;
+    void setNodeItem(NodeId id, Node* node);
+    void moveNodes(const std::vector<Node*>& nodes, const std::vector<QPointF>& positions);
+    bool isMovingNodes() const;
+    const std::vector<Node*>& selectedNodes() const;
+    void nodeSelectionChanged(Node* node, bool selected);
+    void beginDrag(const QPointF& scenePos);
+    void dragTo(const QPointF& scenePos);
+    void endDrag();
+    bool isDragging() const;
     Node* dragConnection(Node* node);
     Node* connectFrom();
     void connectTo(Node* node);
@@ -28,17 +79,46 @@ class DialogueView : public QGraphicsView
   signals:
     void nodeMoved(MoveCommand* movement);
     void nodeConnected(ConnectCommand* connection);
+    void nodeTextRequested(Node* node);
 
   protected:
     void nodeMoveEvent(MoveCommand* movement);
     void nodeConnectEvent(ConnectCommand* connection);
+    void nodeTextEvent(Node* node);
 
     void mousePressEvent(QMouseEvent* event) Q_DECL_OVERRIDE;
+    void mouseMoveEvent(QMouseEvent* event) Q_DECL_OVERRIDE;
     void mouseReleaseEvent(QMouseEvent* event) Q_DECL_OVERRIDE;
     void resizeEvent(QResizeEvent* event) Q_DECL_OVERRIDE;
+    void drawBackground(QPainter* painter, const QRectF& rect) Q_DECL_OVERRIDE;
+    void drawForeground(QPainter* painter, const QRectF& rect) Q_DECL_OVERRIDE;
 
     Node* nodeConnectionFrom;
     Node* nodeConnectionTo;
+
+  private:
+    SlabPool pool;
+    DialogueGraph nodeGraph;
+    EdgeRouter* edgeRouter;
+    EdgeRenderer* edgeRenderer;
+    qreal mediumDetailScale;
+    qreal fullDetailScale;
+    bool movingNodes;
+    std::vector<Node*> nodeItems;
+    SpatialGrid grid;
+    QRubberBand* rubberBand;
+    QPoint bandOrigin;
+    std::vector<NodeId> banded;
+    std::vector<Node*> selection;
+    std::vector<Node*> dragged;
+    std::vector<QPointF> dragStart;
+    std::vector<NodeConnection*> dragBoundary;
+    QPointF dragOrigin;
+    bool overlayVisible;
+    QElapsedTimer frameClock;
+    int frames;
+    qreal framesPerSecond;
+    int itemCount;
 };
 
 class MainWindow : public QMainWindow
@@ -48,24 +128,61 @@ class MainWindow : public QMainWindow
   public:
     MainWindow(QWidget *parent = 0);
     void updateSceneRect();
+    void setHistoryBudget(qint64 bytes);
+    void setAccelerated(bool accelerated);
 
   private slots:
     void open();
     void save();
     void saveAs();
     void exportFile();
+    void exportFinished();
     void quit();
-    void addTextNode();
+    void addNode();
     void deleteItem();
+    void deleteLoose();
+    void autoLayout();
+    void layoutReady();
+    void cancelLayout();
+    void togglePin();
+    void playFromHere();
+    void toggleAcceleration(bool accelerated);
+    void toggleOverlay(bool visible);
+    void toggleTrace(bool recording);
     void nodeMoved(MoveCommand* movement);
     void nodeConnected(ConnectCommand* connection);
+    void editText();
+    void editText(Node* node);
+    void historyChanged();
+    void analyseGraph();
+    void reportReady();
+    void overviewActivated(QTreeWidgetItem* item);
 
   private:
     void createActions();
     void createMenus();
     void createDocks();
+    void createSimulator();
+    void createStatusBar();
+    bool saveFile(const QString& name);
+    std::vector<NodeId> targetsOf(const std::vector<Node*>& nodes) const;
+    void relayout(const std::vector<NodeId>& roots);
 
+    QString fileName;
     QUndoStack* undoStack;
+    qint64 historyBudget;
+    HistoryLedger* history;
+    int spillCursor;
+    int trimCursor;
+    QLabel* historyLabel;
+    JobQueue* jobs;
+    QPointer<AnalysisJob> analysisJob;
+    QPointer<LayoutJob> layoutJob;
+    LayoutCache layoutCache;
+    GraphReport lastReport;
+    bool reportCurrent;
+    QProgressBar* jobProgress;
+    QToolButton* cancelJobsButton;
 
     QAction* openAction;
     QAction* saveAction;
@@ -76,13 +193,25 @@ class MainWindow : public QMainWindow
     QAction* redoAction;
     QAction* deleteAction;
     QAction* deleteLooseAction;
-    QAction* addTextNodeAction;
+    QAction* addNodeActions[KindCount];
+    QAction* playAction;
+    QAction* layoutAction;
+    QAction* pinAction;
+    QAction* textAction;
+    QAction* openGLAction;
+    QAction* overlayAction;
+    QAction* traceAction;
 
     QMenu* fileMenu;
     QMenu* editMenu;
+    QMenu* addMenu;
+    QMenu* viewMenu;
     QToolBar* editToolbar;
     QDockWidget* overviewWidget;
+    QTreeWidget* overviewTree;
     QDockWidget* propertiesWidget;
+    QDockWidget* simulatorWidget;
+    Simulator* simulator;
 
     QGraphicsScene* scene;
     DialogueView* view;
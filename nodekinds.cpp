@@ -0,0 +1,38 @@
+#include "nodekinds.hpp"
+
+template<NodeKind Kind>
+static KindInfo describe()
+{
+  typedef KindTraits<Kind> Traits;
+  KindInfo info = { &Traits::name, &Traits::slotName, Traits::Color, Traits::FileType,
+                    Traits::RuntimeKind, Traits::Slots, Traits::ShowsText };
+  return info;
+}
+
+// Indexed by NodeKind, so the order must follow the enum
+static const KindInfo kinds[KindCount] =
+{
+  describe<TextKind>(),
+  describe<ChoiceKind>(),
+  describe<ConditionKind>(),
+  describe<ScriptKind>(),
+  describe<JumpKind>()
+};
+
+const KindInfo& kindInfo(NodeKind kind)
+{
+  return kinds[kind];
+}
+
+bool kindFromFileType(quint32 type, NodeKind* kind)
+{
+  for (int i = 0; i < KindCount; i++)
+  {
+    if (kinds[i].fileType == type)
+    {
+      *kind = NodeKind(i);
+      return true;
+    }
+  }
+  return false;
+}
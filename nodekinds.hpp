@@ -0,0 +1,114 @@
+#ifndef NODEKINDS_HPP
+#define NODEKINDS_HPP
+
+#include "projectfile.hpp"
+#include "runtime/dialogueruntime.hpp"
+#include <QCoreApplication>
+#include <QString>
+#include <QtGlobal>
+
+// What a node does is a one byte tag stored in the graph, not a subclass.
+// Everything that differs between kinds is described once per kind by a
+// KindTraits specialisation, and code that handles any kind looks it up in
+// a table built from them, so a hot loop pays one indexed load per node
+// instead of a virtual call or a cast.
+//
+//   Text       a line of dialogue, then on to the next node
+//   Choice     a prompt with a labelled answer per slot
+//   Condition  an expression for the game to test; True or False follows
+//   Script     a command for the game to run, then on to the next node
+//   Jump       goes straight to its target, used to avoid long connections
+enum NodeKind
+{
+  TextKind,
+  ChoiceKind,
+  ConditionKind,
+  ScriptKind,
+  JumpKind,
+  KindCount
+};
+
+template<NodeKind Kind> struct KindTraits;
+
+// Slots only apply to new nodes, loaded ones keep the slots they were saved
+// with. Text nodes once started with a second "Nextorino" slot, so they can
+// still have two in older projects.
+template<> struct KindTraits<TextKind>
+{
+  static const quint32 Color = 0xffc8c8c8;
+  static const quint32 FileType = ProjectFormat::TextNodeType;
+  static const quint32 RuntimeKind = DialogueRuntime::TextNode;
+  static const int Slots = 1;
+  static const bool ShowsText = true;
+
+  static QString name() { return QCoreApplication::translate("NodeKind", "Text"); }
+  static QString slotName(int) { return QCoreApplication::translate("NodeKind", "Next"); }
+};
+
+template<> struct KindTraits<ChoiceKind>
+{
+  static const quint32 Color = 0xffb4c8e6;
+  static const quint32 FileType = ProjectFormat::ChoiceNodeType;
+  static const quint32 RuntimeKind = DialogueRuntime::ChoiceNode;
+  static const int Slots = 2;
+  static const bool ShowsText = true;
+
+  static QString name() { return QCoreApplication::translate("NodeKind", "Choice"); }
+  static QString slotName(int slot) { return QCoreApplication::translate("NodeKind", "Choice %1").arg(slot + 1); }
+};
+
+template<> struct KindTraits<ConditionKind>
+{
+  static const quint32 Color = 0xffe6d2a0;
+  static const quint32 FileType = ProjectFormat::ConditionNodeType;
+  static const quint32 RuntimeKind = DialogueRuntime::ConditionNode;
+  static const int Slots = 2;
+  static const bool ShowsText = true;
+
+  static QString name() { return QCoreApplication::translate("NodeKind", "Condition"); }
+  static QString slotName(int slot)
+  {
+    return slot == 0 ? QCoreApplication::translate("NodeKind", "True") : QCoreApplication::translate("NodeKind", "False");
+  }
+};
+
+template<> struct KindTraits<ScriptKind>
+{
+  static const quint32 Color = 0xffbedcbe;
+  static const quint32 FileType = ProjectFormat::ScriptNodeType;
+  static const quint32 RuntimeKind = DialogueRuntime::ScriptNode;
+  static const int Slots = 1;
+  static const bool ShowsText = true;
+
+  static QString name() { return QCoreApplication::translate("NodeKind", "Script"); }
+  static QString slotName(int) { return QCoreApplication::translate("NodeKind", "Next"); }
+};
+
+template<> struct KindTraits<JumpKind>
+{
+  static const quint32 Color = 0xffd2bedc;
+  static const quint32 FileType = ProjectFormat::JumpNodeType;
+  static const quint32 RuntimeKind = DialogueRuntime::JumpNode;
+  static const int Slots = 1;
+  static const bool ShowsText = false;
+
+  static QString name() { return QCoreApplication::translate("NodeKind", "Jump"); }
+  static QString slotName(int) { return QCoreApplication::translate("NodeKind", "Target"); }
+};
+
+// One row per kind, filled from the traits above
+struct KindInfo
+{
+  QString (*name)();
+  QString (*slotName)(int slot);
+  quint32 color;
+  quint32 fileType;
+  quint32 runtimeKind;
+  int slots;
+  bool showsText;
+};
+
+const KindInfo& kindInfo(NodeKind kind);
+bool kindFromFileType(quint32 type, NodeKind* kind);
+
+#endif // NODEKINDS_HPP
@@ -1,8 +1,12 @@
 #include "nodes.hpp"
 #include "mainwindow.hpp"
 #include "commands.hpp"
+#include "edges.hpp"
+#include "pool.hpp"
+#include "profiler.hpp"
 #include <QStyleOptionGraphicsItem>
 #include <QPainter>
+#include <QGraphicsScene>
 #include <QGraphicsSceneEvent>
 #include <QMimeData>
 #include <utility>
@@ -10,41 +14,98 @@
 static const float HandleWidth = 15.f;
 static const float ConnectionHeight = 20.f;
 
-NodeConnection::NodeConnection(Node* source, unsigned int sourceSlot, QString name)
-  : name(name)
-  , dest(0)
+NodeConnection::NodeConnection(Node* source, unsigned int sourceSlot)
+  : QGraphicsItem(source)
   , source(source)
   , sourceSlot(sourceSlot)
+  , dirty(false)
+  , labelName(NoId)
+  , highlighted(false)
 {
+  labelText.setTextFormat(Qt::PlainText);
+  labelText.setPerformanceHint(QStaticText::AggressiveCaching);
+  setFlag(ItemStacksBehindParent);
+  setFlag(ItemUsesExtendedStyleOption);
+  setAcceptedMouseButtons(Qt::NoButton);
 }
 
-void NodeConnection::setNode(Node* newNode)
+void* NodeConnection::operator new(size_t size)
 {
-  if (dest)
-  {
-    dest->receivers.erase(this);
-  }
-  dest = newNode;
-  calculatePath();
+  return SlabPool::allocateUnpooled(size);
+}
+
+void* NodeConnection::operator new(size_t size, SlabPool& pool)
+{
+  return pool.allocate(size);
+}
+
+void NodeConnection::operator delete(void* block)
+{
+  SlabPool::release(block);
+}
+
+void NodeConnection::operator delete(void* block, SlabPool& pool)
+{
+  Q_UNUSED(pool);
+  SlabPool::release(block);
+}
+
+EdgeId NodeConnection::edge() const
+{
+  return source->graph()->edge(source->id(), sourceSlot);
+}
+
+const QString& NodeConnection::name() const
+{
+  return source->graph()->edgeName(edge());
+}
+
+void NodeConnection::setName(const QString& name)
+{
+  // Released ids are reused, so the old one could come back for a new name
+  source->graph()->setEdgeName(edge(), name);
+  labelName = NoId;
   source->update();
-  if (dest)
+}
+
+const QStaticText& NodeConnection::label(const QFont& font)
+{
+  // Laid out once and reused until the name or font changes; interned
+  // names tell a change apart by id alone
+  StringId current = source->graph()->edgeNameId(edge());
+  if (current != labelName || font != labelFont)
   {
-    dest->receivers.insert(this);
+    labelText.setText(name());
+    labelText.prepare(QTransform(), font);
+    labelFont = font;
+    labelName = current;
   }
+  return labelText;
+}
+
+void NodeConnection::setNode(Node* newNode)
+{
+  source->graph()->setEdgeTarget(edge(), newNode ? newNode->id() : NoId);
+  calculatePath();
 }
 
 Node* NodeConnection::node()
 {
-  return dest;
+  NodeId dest = source->graph()->edgeTarget(edge());
+  return dest == NoId ? 0 : source->view()->nodeItem(dest);
 }
 
 void NodeConnection::calculatePath()
 {
+  PROFILE_SCOPE("NodeConnection::calculatePath");
+  prepareGeometryChange();
   path = QPainterPath();
+  Node* dest = node();
   if (dest)
   {
+    routedOffset = dest->pos() - source->pos();
     QPointF start = source->startPoint(sourceSlot);
-    QPointF end = dest->pos() + dest->endPoint() - source->pos();
+    QPointF end = routedOffset + dest->endPoint();
     QPointF c = QPointF(50.f, 0.f);
     QPointF m = QPointF(5.f, 0.f);
     path.moveTo(start);
@@ -52,17 +113,199 @@ void NodeConnection::calculatePath()
     path.cubicTo(start + c + m, end - c - m, end - m);
     path.lineTo(end);
   }
+  bounds = path.boundingRect().marginsAdded(QMarginsF(5, 5, 5, 5));
+  source->view()->invalidateEdges();
+}
+
+void NodeConnection::setHighlighted(bool highlighted)
+{
+  if (this->highlighted != highlighted)
+  {
+    this->highlighted = highlighted;
+    source->view()->invalidateEdges();
+    update();
+  }
+}
+
+void NodeConnection::route()
+{
+  // The path is in source coordinates, so when both ends moved together,
+  // e.g. inside a dragged selection, the item transform already covers it
+  dirty = false;
+  Node* dest = node();
+  if (!dest || path.isEmpty() || dest->pos() - source->pos() != routedOffset)
+  {
+    calculatePath();
+  }
+}
+
+QRectF NodeConnection::boundingRect() const
+{
+  return bounds;
+}
+
+void NodeConnection::paint(QPainter* painter, const QStyleOptionGraphicsItem* item, QWidget* widget)
+{
+  Q_UNUSED(widget);
+
+  // Accelerated views draw all connections in one batch instead
+  if (path.isEmpty() || source->view()->isAccelerated())
+  {
+    return;
+  }
+  if (highlighted)
+  {
+    painter->setPen(QPen(QColor(200, 120, 0), 2));
+  }
+  qreal lod = item->levelOfDetailFromTransform(painter->worldTransform());
+  if (source->view()->detailLevel(lod) == DialogueView::LowDetail)
+  {
+    painter->setRenderHint(QPainter::Antialiasing, false);
+    painter->drawLine(path.elementAt(0), path.elementAt(path.elementCount() - 1));
+    return;
+  }
+  painter->setBrush(Qt::NoBrush);
+  painter->setRenderHint(QPainter::Antialiasing, true);
+
+  // Long connections cross far more of the scene than they cover, so only
+  // the part of the curve inside the exposed area is stroked
+  QPointF curve[4] = { path.elementAt(1), path.elementAt(2), path.elementAt(3), path.elementAt(4) };
+  qreal from, to;
+  QRectF exposed = item->exposedRect.marginsAdded(QMarginsF(2, 2, 2, 2));
+  if (!clipCubic(curve, exposed, &from, &to))
+  {
+    painter->drawLine(path.elementAt(0), curve[0]);
+    painter->drawLine(curve[3], path.elementAt(5));
+    return;
+  }
+  if (from == 0 && to == 1)
+  {
+    painter->drawPath(path);
+    return;
+  }
+  QPointF section[4];
+  cubicSection(curve, from, to, section);
+  QPainterPath visible;
+  if (from == 0)
+  {
+    visible.moveTo(path.elementAt(0));
+    visible.lineTo(section[0]);
+  }
+  else
+  {
+    visible.moveTo(section[0]);
+  }
+  visible.cubicTo(section[1], section[2], section[3]);
+  if (to == 1)
+  {
+    visible.lineTo(path.elementAt(5));
+  }
+  painter->drawPath(visible);
 }
 
-Node::Node(DialogueView* view)
+Node::Node(DialogueView* view, NodeKind kind)
   : parent(view)
-  , canMove(false)
+  , nodeId(view->graph()->addNode(QPointF(), kind))
+  , selectionIndex(-1)
+  , canMove(true)
+  , highlighted(false)
   , size(0.f, 0.f, 120.f, 50.f)
 {
   setFlag(ItemIsSelectable);
+  setFlag(ItemSendsGeometryChanges);
   setFlag(ItemSendsScenePositionChanges);
   setAcceptHoverEvents(true);
   setAcceptDrops(true);
+  parent->setNodeItem(nodeId, this);
+  const KindInfo& info = kindInfo(kind);
+  for (int slot = 0; slot < info.slots; slot++)
+  {
+    addConnection(info.slotName(slot));
+  }
+}
+
+Node::Node(DialogueView* view, NodeId id)
+  : parent(view)
+  , nodeId(id)
+  , selectionIndex(-1)
+  , canMove(true)
+  , highlighted(false)
+  , size(0.f, 0.f, 120.f, 50.f)
+{
+  setFlag(ItemIsSelectable);
+  setFlag(ItemSendsGeometryChanges);
+  setFlag(ItemSendsScenePositionChanges);
+  setAcceptHoverEvents(true);
+  setAcceptDrops(true);
+  setPos(graph()->position(nodeId));
+  createConnections();
+  parent->setNodeItem(nodeId, this);
+}
+
+Node::~Node()
+{
+  for (auto& connection : connections)
+  {
+    if (connection->dirty)
+    {
+      parent->router()->forget(this);
+      break;
+    }
+  }
+  if (!connections.empty())
+  {
+    parent->invalidateEdges();
+  }
+  parent->spatialIndex().remove(nodeId);
+  parent->nodeSelectionChanged(this, false);
+  parent->setNodeItem(nodeId, 0);
+}
+
+void* Node::operator new(size_t size)
+{
+  return SlabPool::allocateUnpooled(size);
+}
+
+void* Node::operator new(size_t size, SlabPool& pool)
+{
+  return pool.allocate(size);
+}
+
+void Node::operator delete(void* block)
+{
+  SlabPool::release(block);
+}
+
+void Node::operator delete(void* block, SlabPool& pool)
+{
+  Q_UNUSED(pool);
+  SlabPool::release(block);
+}
+
+NodeId Node::id() const
+{
+  return nodeId;
+}
+
+DialogueGraph* Node::graph() const
+{
+  return parent->graph();
+}
+
+NodeKind Node::kind() const
+{
+  return graph()->kind(nodeId);
+}
+
+const QString& Node::text() const
+{
+  return graph()->text(nodeId);
+}
+
+void Node::setText(const QString& text)
+{
+  graph()->setText(nodeId, text);
+  update();
 }
 
 void Node::setConnection(int slot, Node* node)
@@ -95,24 +338,54 @@ QPointF Node::startPoint(int connection)
   return QPointF(size.width(), size.height() + .5f * ConnectionHeight * (connection * 2 + 1));
 }
 
-QRectF Node::boundingRect() const
+void Node::updatePaths()
 {
-  QRectF s;
-  s.setHeight(size.height() + connections.size() * ConnectionHeight);
-  s.setWidth(size.width() + HandleWidth);
-  s.setLeft(-HandleWidth);
   for (auto& connection : connections)
   {
-    QRectF box = connection->path.boundingRect();
-    s = s.united(box.marginsAdded(QMargins(5, 5, 5, 5)));
+    connection->calculatePath();
+  }
+  update();
+}
+
+std::vector<NodeConnection*> Node::receivers() const
+{
+  std::vector<NodeConnection*> result;
+  result.reserve(graph()->incomingCount(nodeId));
+  for (EdgeId edge = graph()->firstIncoming(nodeId); edge != NoId; edge = graph()->nextIncoming(edge))
+  {
+    Node* source = parent->nodeItem(graph()->edgeSource(edge));
+    if (source)
+    {
+      result.push_back(source->connections[graph()->edgeSlot(edge)].get());
+    }
+  }
+  return result;
+}
+
+void Node::setHighlighted(bool highlighted)
+{
+  if (this->highlighted != highlighted)
+  {
+    this->highlighted = highlighted;
+    update();
   }
-  for (auto reciever : receivers)
+}
+
+void Node::setConnectionHighlighted(int slot, bool highlighted)
+{
+  if (slot >= 0 && slot < int(connections.size()))
   {
-    QRectF box = reciever->path.boundingRect();
-    box.translate(reciever->source->pos() - pos());
-    s = s.united(box.marginsAdded(QMargins(5, 5, 5, 5)));
+    connections[slot]->setHighlighted(highlighted);
   }
-  s = s.united(oldBounds);
+}
+
+QRectF Node::boundingRect() const
+{
+  PROFILE_SCOPE("Node::boundingRect");
+  QRectF s;
+  s.setHeight(size.height() + connections.size() * ConnectionHeight);
+  s.setWidth(size.width() + HandleWidth);
+  s.setLeft(-HandleWidth);
   return s;
 }
 
@@ -130,10 +403,24 @@ QPainterPath Node::shape() const
 int Node::addConnection(QString name)
 {
   unsigned int slot = (unsigned int)connections.size();
-  connections.push_back(std::unique_ptr<NodeConnection>(new NodeConnection(this, slot, name)));
+  graph()->addEdge(nodeId, name);
+  connections.push_back(std::unique_ptr<NodeConnection>(new (parent->itemPool()) NodeConnection(this, slot)));
+  if (QGraphicsItem::scene())
+  {
+    parent->spatialIndex().update(nodeId, sceneBoundingRect());
+  }
   return slot;
 }
 
+void Node::createConnections()
+{
+  unsigned int count = graph()->edgeCount(nodeId);
+  for (unsigned int slot = 0; slot < count; slot++)
+  {
+    connections.push_back(std::unique_ptr<NodeConnection>(new (parent->itemPool()) NodeConnection(this, slot)));
+  }
+}
+
 QGraphicsScene* Node::scene()
 {
   return parent->scene();
@@ -146,16 +433,33 @@ DialogueView* Node::view()
 
 QVariant Node::itemChange(GraphicsItemChange change, const QVariant& value)
 {
-  if (change == QGraphicsItem::ItemScenePositionHasChanged) {
-    for (auto& connection : connections)
+  if (change == QGraphicsItem::ItemSelectedHasChanged)
+  {
+    parent->nodeSelectionChanged(this, value.toBool());
+  }
+  if (change == QGraphicsItem::ItemSceneHasChanged)
+  {
+    if (value.value<QGraphicsScene*>())
     {
-      connection->calculatePath();
+      parent->spatialIndex().update(nodeId, sceneBoundingRect());
     }
-    for (auto receiver : receivers)
+    else
     {
-      receiver->calculatePath();
+      parent->spatialIndex().remove(nodeId);
     }
   }
+  if (parent->isMovingNodes())
+  {
+    return value;
+  }
+  if (change == QGraphicsItem::ItemPositionHasChanged)
+  {
+    graph()->setPosition(nodeId, value.toPointF());
+    parent->spatialIndex().update(nodeId, sceneBoundingRect());
+  }
+  else if (change == QGraphicsItem::ItemScenePositionHasChanged) {
+    view()->router()->nodeMoved(this);
+  }
   return value;
 }
 
@@ -165,27 +469,13 @@ void Node::mousePressEvent(QGraphicsSceneMouseEvent* event)
   {
     if (event->pos().x() < 0 || event->pos().y() < size.height())
     {
-      if (!scene()->selectedItems().contains(this))
-      {
-        if (canMove)
-        {
-          setFlag(ItemIsMovable);
-          oldPos = pos();
-        }
-      }
-      else
+      // The base class settles the selection first; the view then drags
+      // whatever ends up selected
+      QGraphicsItem::mousePressEvent(event);
+      if (isSelected())
       {
-        for (auto item : scene()->selectedItems())
-        {
-          auto item_cast = dynamic_cast<Node*>(item);
-          if (item_cast && item_cast->canMove)
-          {
-            item_cast->setFlag(ItemIsMovable);
-            item_cast->oldPos = item_cast->pos();
-          }
-        }
+        view()->beginDrag(event->scenePos());
       }
-      QGraphicsItem::mousePressEvent(event);
     }
     else
     {
@@ -204,28 +494,37 @@ void Node::mousePressEvent(QGraphicsSceneMouseEvent* event)
   }
 }
 
+void Node::mouseMoveEvent(QGraphicsSceneMouseEvent* event)
+{
+  if (view()->isDragging())
+  {
+    view()->dragTo(event->scenePos());
+  }
+  else
+  {
+    QGraphicsItem::mouseMoveEvent(event);
+  }
+}
+
 void Node::mouseReleaseEvent(QGraphicsSceneMouseEvent* event)
 {
   QGraphicsItem::mouseReleaseEvent(event);
-  if (flags() & ItemIsMovable)
+  if (view()->isDragging())
   {
-    std::vector<MoveCommand::Movement> movements;
-    for (auto item : scene()->selectedItems())
-    {
-      auto item_cast = dynamic_cast<Node*>(item);
-      if (item_cast && item_cast->canMove)
-      {
-        item_cast->setFlag(ItemIsMovable, false);
-        if (item_cast->pos() != item_cast->oldPos)
-        {
-          movements.push_back(MoveCommand::Movement{item_cast, item_cast->oldPos, item_cast->pos()});
-        }
-      }
-    }
-    if (!movements.empty())
-    {
-      view()->nodeMoveEvent(new MoveCommand(std::move(movements)));
-    }
+    view()->endDrag();
+  }
+}
+
+void Node::mouseDoubleClickEvent(QGraphicsSceneMouseEvent* event)
+{
+  if (event->button() == Qt::LeftButton && kindInfo(kind()).showsText)
+  {
+    view()->nodeTextEvent(this);
+    event->accept();
+  }
+  else
+  {
+    QGraphicsItem::mouseDoubleClickEvent(event);
   }
 }
 
@@ -263,20 +562,41 @@ void Node::dropEvent(QGraphicsSceneDragDropEvent* event)
 }
 
 
+// Every node of a kind shows the same name, so each is laid out only once
+static const QStaticText& kindLabel(NodeKind kind, const QFont& font)
+{
+  static QStaticText labels[KindCount];
+  static QFont fonts[KindCount];
+  QStaticText& label = labels[kind];
+  if (label.text().isEmpty() || font != fonts[kind])
+  {
+    label.setTextFormat(Qt::PlainText);
+    label.setText(kindInfo(kind).name());
+    label.prepare(QTransform(), font);
+    fonts[kind] = font;
+  }
+  return label;
+}
+
 void Node::paint(QPainter* painter, const QStyleOptionGraphicsItem* item, QWidget* widget)
 {
-  Q_UNUSED(item);
+  PROFILE_SCOPE("Node::paint");
   Q_UNUSED(widget);
 
-  painter->setBrush(Qt::NoBrush);
-  painter->setRenderHint(QPainter::Antialiasing, true);
-  for (auto& connection : connections)
-  {
-    painter->drawPath(connection->path);
-  }
   painter->setRenderHint(QPainter::Antialiasing, false);
 
   const QColor handleColor = QColor(100, 100, 100);
+  qreal lod = item->levelOfDetailFromTransform(painter->worldTransform());
+  DialogueView::DetailLevel detail = view()->detailLevel(lod);
+  NodeKind nodeKind = graph()->kind(nodeId);
+  const KindInfo& info = kindInfo(nodeKind);
+  if (detail == DialogueView::LowDetail)
+  {
+    QColor color = highlighted ? QColor(240, 220, 150) : QColor::fromRgba(info.color);
+    painter->fillRect(boundingRect(), item->state & QStyle::State_Selected ? color.light(110) : color);
+    return;
+  }
+
   QRectF handleBox;
   handleBox.setHeight(size.height() + connections.size() * ConnectionHeight);
   handleBox.setWidth(HandleWidth + 1.f);
@@ -293,10 +613,10 @@ void Node::paint(QPainter* painter, const QStyleOptionGraphicsItem* item, QWidge
   }
   painter->drawRect(handleBox);
   painter->setPen(handleColor);
-  painter->setBrush(QBrush(handleColor, Qt::Dense3Pattern));
+  painter->setBrush(QBrush(handleColor, graph()->isPinned(nodeId) ? Qt::Dense1Pattern : Qt::Dense3Pattern));
   painter->drawRect(handleBox);
 
-  QColor color = QColor(200, 200, 200);
+  QColor color = highlighted ? QColor(240, 220, 150) : QColor::fromRgba(info.color);
   if (item->state & QStyle::State_Selected)
   {
     color = color.light(110);
@@ -307,6 +627,21 @@ void Node::paint(QPainter* painter, const QStyleOptionGraphicsItem* item, QWidge
   painter->setPen(handleColor);
   painter->setBrush(boxColor);
   painter->drawRect(box);
+  if (detail == DialogueView::FullDetail)
+  {
+    painter->setPen(handleColor.dark(150));
+    painter->drawStaticText(box.topLeft() + QPointF(5, 2), kindLabel(nodeKind, painter->font()));
+    const QString& text = graph()->text(nodeId);
+    if (info.showsText && !text.isEmpty())
+    {
+      // Only the first line fits, the rest is in the editor and simulator
+      QRectF textBox = box.adjusted(5, 20, -5, -2);
+      QString line = text.left(text.indexOf('\n'));
+      painter->drawText(textBox, Qt::AlignLeft | Qt::AlignTop,
+                        painter->fontMetrics().elidedText(line, Qt::ElideRight, int(textBox.width())));
+    }
+    painter->setPen(handleColor);
+  }
 
   QColor connectionColor = color;
   box.moveTop(box.height() - 1.f);
@@ -315,34 +650,14 @@ void Node::paint(QPainter* painter, const QStyleOptionGraphicsItem* item, QWidge
   {
     painter->setBrush(connectionColor);
     painter->drawRect(box);
-    painter->setPen(handleColor.dark(150));
-    painter->drawText(box.marginsRemoved(QMargins(5, 0, 5, 0)), Qt::AlignRight, connection->name);
-    painter->setPen(handleColor);
+    if (detail == DialogueView::FullDetail)
+    {
+      const QStaticText& label = connection->label(painter->font());
+      QRectF labelBox = box.marginsRemoved(QMargins(5, 0, 5, 0));
+      painter->setPen(handleColor.dark(150));
+      painter->drawStaticText(QPointF(labelBox.right() - label.size().width(), labelBox.top()), label);
+      painter->setPen(handleColor);
+    }
     box.moveTop(box.bottom() - 1.f);
   }
-
-  oldBounds = boundingRect();
-}
-
-TextNode::TextNode(DialogueView* view)
-  : Node(view)
-{
-  setMoveable(true);
-  addConnection("Next");
-  addConnection("Nextorino");
-}
-
-void TextNode::paint(QPainter* painter, const QStyleOptionGraphicsItem* item, QWidget* widget)
-{
-  Node::paint(painter, item, widget);
-}
-
-void TextNode::setText(const QString& text)
-{
-  txt = text;
-}
-
-const QString& TextNode::text() const
-{
-  return txt;
 }
@@ -1,45 +1,93 @@
 #ifndef NODES_HPP
 #define NODES_HPP
 
+#include "graph.hpp"
 #include <QGraphicsItem>
+#include <QStaticText>
 #include <memory>
 #include <vector>
-#include <set>
 
 class DialogueView;
 class QGraphicsScene;
+class SlabPool;
 class Node;
 
-class NodeConnection
+class NodeConnection : public QGraphicsItem
 {
     friend class Node;
+    friend class EdgeRouter;
+    friend class EdgeRenderer;
+    friend class ConnectCommand;
   public:
-    NodeConnection(Node* source, unsigned int id, QString name);
+    NodeConnection(Node* source, unsigned int id);
+
+    static void* operator new(size_t size);
+    static void* operator new(size_t size, SlabPool& pool);
+    static void operator delete(void* block);
+    static void operator delete(void* block, SlabPool& pool);
+
+    EdgeId edge() const;
+    const QString& name() const;
+    void setName(const QString& name);
+    const QStaticText& label(const QFont& font);
     void setNode(Node* newNode);
     Node* node();
     void calculatePath();
+    void setHighlighted(bool highlighted);
+
+    QRectF boundingRect() const Q_DECL_OVERRIDE;
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *item, QWidget *widget) Q_DECL_OVERRIDE;
 
   private:
-    QString name;
-    Node* dest;
+    void route();
+
     Node* source;
     unsigned int sourceSlot;
     QPainterPath path;
+    QRectF bounds;
+    QPointF routedOffset;
+    bool dirty;
+    QStaticText labelText;
+    QFont labelFont;
+    StringId labelName;
+    bool highlighted;
 };
 
 class Node : public QGraphicsItem
 {
     friend class NodeConnection;
+    friend class EdgeRouter;
+    friend class EdgeRenderer;
+    friend class MoveCommand;
+    friend class ConnectCommand;
     friend class DeleteCommand;
+    friend class TextCommand;
+    friend class DialogueView;
   public:
-    Node(DialogueView* view);
-
+    Node(DialogueView* view, NodeKind kind);
+    Node(DialogueView* view, NodeId id);
+    ~Node();
+
+    static void* operator new(size_t size);
+    static void* operator new(size_t size, SlabPool& pool);
+    static void operator delete(void* block);
+    static void operator delete(void* block, SlabPool& pool);
+
+    NodeId id() const;
+    DialogueGraph* graph() const;
+    NodeKind kind() const;
+    const QString& text() const;
+    void setText(const QString& text);
     void setConnection(int slot, Node* node);
     Node* connection(int slot);
     void setMoveable(bool moveable);
     bool movable();
     QPointF endPoint();
     QPointF startPoint(int connection);
+    void updatePaths();
+    std::vector<NodeConnection*> receivers() const;
+    void setHighlighted(bool highlighted);
+    void setConnectionHighlighted(int slot, bool highlighted);
 
     QRectF boundingRect() const Q_DECL_OVERRIDE;
     QPainterPath shape() const Q_DECL_OVERRIDE;
@@ -51,35 +99,25 @@ class Node : public QGraphicsItem
 
     QVariant itemChange(GraphicsItemChange change, const QVariant& value) Q_DECL_OVERRIDE;
     void mousePressEvent(QGraphicsSceneMouseEvent* event) Q_DECL_OVERRIDE;
+    void mouseMoveEvent(QGraphicsSceneMouseEvent* event) Q_DECL_OVERRIDE;
     void mouseReleaseEvent(QGraphicsSceneMouseEvent* event) Q_DECL_OVERRIDE;
+    void mouseDoubleClickEvent(QGraphicsSceneMouseEvent* event) Q_DECL_OVERRIDE;
     void paint(QPainter *painter, const QStyleOptionGraphicsItem *item, QWidget *widget) Q_DECL_OVERRIDE;
     void dragEnterEvent(QGraphicsSceneDragDropEvent* event) Q_DECL_OVERRIDE;
     void dropEvent(QGraphicsSceneDragDropEvent* event) Q_DECL_OVERRIDE;
 
   private:
+    void createConnections();
+
     DialogueView* parent;
-    QPointF oldPos;
-    QRectF oldBounds;
+    NodeId nodeId;
+    int selectionIndex;
     bool canMove;
+    bool highlighted;
 
   protected:
     QRectF size;
     std::vector<std::unique_ptr<NodeConnection>> connections;
-    std::set<NodeConnection*> receivers;
-};
-
-class TextNode : public Node
-{
-  public:
-    TextNode(DialogueView* view);
-
-    void paint(QPainter *painter, const QStyleOptionGraphicsItem *item, QWidget *widget) Q_DECL_OVERRIDE;
-
-    void setText(const QString& text);
-    const QString& text() const;
-
-  private:
-    QString txt;
 };
 
 #endif // NODES_HPP
@@ -0,0 +1,41 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <QtGlobal>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+// Splits [0, count) into at most one chunk per thread, each at least
+// minChunk long, so small inputs run inline on the calling thread.
+inline unsigned int idealThreadCount()
+{
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+inline quint32 parallelChunks(unsigned int threads, quint32 count, quint32 minChunk)
+{
+  return std::max(1u, std::min(quint32(threads), count / std::max(1u, minChunk)));
+}
+
+// Calls function(begin, end, chunk) for every chunk; the first chunk runs on
+// the calling thread and the call returns once all of them are done
+template<typename Function>
+void parallelFor(unsigned int threads, quint32 count, quint32 minChunk, Function function)
+{
+  quint32 chunks = parallelChunks(threads, count, minChunk);
+  quint32 chunkSize = (count + chunks - 1) / chunks;
+  std::vector<std::thread> workers;
+  for (quint32 chunk = 1; chunk < chunks; chunk++)
+  {
+    quint32 begin = chunk * chunkSize;
+    workers.emplace_back(function, begin, std::min(count, begin + chunkSize), chunk);
+  }
+  function(0u, std::min(count, chunkSize), 0u);
+  for (auto& worker : workers)
+  {
+    worker.join();
+  }
+}
+
+#endif // PARALLEL_HPP
@@ -0,0 +1,85 @@
+#include "pool.hpp"
+#include <new>
+
+static const size_t Granularity = 16;
+
+SlabPool::SlabPool(size_t slabSize)
+  : slabSize(slabSize)
+  , cursor(0)
+  , end(0)
+{
+}
+
+SlabPool::~SlabPool()
+{
+  for (auto slab : slabs)
+  {
+    ::operator delete(slab);
+  }
+}
+
+void* SlabPool::allocate(size_t size)
+{
+  size_t sizeClass = (size + sizeof(Header) + Granularity - 1) / Granularity;
+  size_t blockSize = sizeClass * Granularity;
+  if (blockSize > slabSize)
+  {
+    return allocateUnpooled(size);
+  }
+
+  char* block;
+  if (sizeClass < freeLists.size() && freeLists[sizeClass])
+  {
+    FreeBlock* free = freeLists[sizeClass];
+    freeLists[sizeClass] = free->next;
+    block = reinterpret_cast<char*>(free);
+  }
+  else
+  {
+    if (size_t(end - cursor) < blockSize)
+    {
+      cursor = static_cast<char*>(::operator new(slabSize));
+      end = cursor + slabSize;
+      slabs.push_back(cursor);
+    }
+    block = cursor;
+    cursor += blockSize;
+  }
+
+  Header* header = reinterpret_cast<Header*>(block);
+  header->owner.pool = this;
+  header->owner.sizeClass = sizeClass;
+  return header + 1;
+}
+
+void* SlabPool::allocateUnpooled(size_t size)
+{
+  Header* header = static_cast<Header*>(::operator new(size + sizeof(Header)));
+  header->owner.pool = 0;
+  header->owner.sizeClass = 0;
+  return header + 1;
+}
+
+void SlabPool::release(void* block)
+{
+  if (!block)
+  {
+    return;
+  }
+  Header* header = static_cast<Header*>(block) - 1;
+  SlabPool* pool = header->owner.pool;
+  if (!pool)
+  {
+    ::operator delete(header);
+    return;
+  }
+
+  size_t sizeClass = header->owner.sizeClass;
+  if (sizeClass >= pool->freeLists.size())
+  {
+    pool->freeLists.resize(sizeClass + 1, 0);
+  }
+  FreeBlock* free = reinterpret_cast<FreeBlock*>(header);
+  free->next = pool->freeLists[sizeClass];
+  pool->freeLists[sizeClass] = free;
+}
@@ -0,0 +1,47 @@
+#ifndef POOL_HPP
+#define POOL_HPP
+
+#include <cstddef>
+#include <vector>
+
+// Carves small objects out of large slabs, with one free list per 16 byte
+// size class. Every block is prefixed with its owning pool so it can be
+// released without knowing where it came from; blocks with no pool went to
+// the regular heap.
+class SlabPool
+{
+  public:
+    SlabPool(size_t slabSize = 64 * 1024);
+    ~SlabPool();
+
+    void* allocate(size_t size);
+    static void* allocateUnpooled(size_t size);
+    static void release(void* block);
+
+  private:
+    union Header
+    {
+      struct
+      {
+        SlabPool* pool;
+        size_t sizeClass;
+      } owner;
+      std::max_align_t align;
+    };
+
+    struct FreeBlock
+    {
+      FreeBlock* next;
+    };
+
+    SlabPool(const SlabPool&);
+    SlabPool& operator=(const SlabPool&);
+
+    size_t slabSize;
+    std::vector<char*> slabs;
+    std::vector<FreeBlock*> freeLists;
+    char* cursor;
+    char* end;
+};
+
+#endif // POOL_HPP
@@ -0,0 +1,173 @@
+#include "profiler.hpp"
+
+#ifdef DIALOGUENODE_PROFILE
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTextStream>
+
+namespace
+{
+  struct Event
+  {
+    const Profiler::Site* site;
+    qint64 start;
+    qint64 duration;
+  };
+
+  struct Counter
+  {
+    qint64 time;
+    std::vector<quint64> calls;
+  };
+
+  // Long recordings stop growing rather than exhausting memory
+  const size_t MaxEvents = 4 * 1024 * 1024;
+
+  struct State
+  {
+    State()
+      : tracing(false)
+    {
+      clock.start();
+    }
+
+    QElapsedTimer clock;
+    std::vector<Profiler::Site*> sites;
+    bool tracing;
+    std::vector<Event> events;
+    std::vector<Counter> counters;
+  };
+
+  State& state()
+  {
+    static State instance;
+    return instance;
+  }
+}
+
+Profiler::Site::Site(const char* name)
+  : name(name)
+  , calls(0)
+  , nanoseconds(0)
+  , frameCalls(0)
+  , frameNanoseconds(0)
+{
+  state().sites.push_back(this);
+}
+
+Profiler::Scope::Scope(Site& site)
+  : site(site)
+  , start(now())
+{
+}
+
+Profiler::Scope::~Scope()
+{
+  qint64 duration = now() - start;
+  site.calls++;
+  site.nanoseconds += duration;
+  State& s = state();
+  if (s.tracing && s.events.size() < MaxEvents)
+  {
+    s.events.push_back(Event{&site, start, duration});
+  }
+}
+
+qint64 Profiler::now()
+{
+  return state().clock.nsecsElapsed();
+}
+
+void Profiler::count(Site& site)
+{
+  site.calls++;
+}
+
+const std::vector<Profiler::Site*>& Profiler::sites()
+{
+  return state().sites;
+}
+
+void Profiler::frame()
+{
+  State& s = state();
+  Counter counter;
+  counter.time = now();
+  for (auto site : s.sites)
+  {
+    site->frameCalls = site->calls;
+    site->frameNanoseconds = site->nanoseconds;
+    site->calls = 0;
+    site->nanoseconds = 0;
+    counter.calls.push_back(site->frameCalls);
+  }
+  if (s.tracing && s.counters.size() < MaxEvents)
+  {
+    s.counters.push_back(std::move(counter));
+  }
+}
+
+void Profiler::startTrace()
+{
+  State& s = state();
+  s.events.clear();
+  s.counters.clear();
+  s.tracing = true;
+}
+
+bool Profiler::stopTrace(const QString& fileName)
+{
+  // Chrome's trace event format: complete events for scopes and one
+  // counter event per frame, with times in microseconds
+  State& s = state();
+  s.tracing = false;
+  QFile file(fileName);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+  {
+    discardTrace();
+    return false;
+  }
+  QTextStream stream(&file);
+  stream << "{\"traceEvents\":[\n";
+  bool first = true;
+  for (auto& event : s.events)
+  {
+    stream << (first ? "" : ",\n");
+    stream << "{\"name\":\"" << event.site->name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1"
+           << ",\"ts\":" << QString::number(event.start / 1000.0, 'f', 3)
+           << ",\"dur\":" << QString::number(event.duration / 1000.0, 'f', 3) << "}";
+    first = false;
+  }
+  for (auto& counter : s.counters)
+  {
+    stream << (first ? "" : ",\n");
+    stream << "{\"name\":\"Calls per frame\",\"ph\":\"C\",\"pid\":1,\"tid\":1"
+           << ",\"ts\":" << QString::number(counter.time / 1000.0, 'f', 3) << ",\"args\":{";
+    for (size_t i = 0; i < counter.calls.size(); i++)
+    {
+      stream << (i ? "," : "") << "\"" << s.sites[i]->name << "\":" << counter.calls[i];
+    }
+    stream << "}}";
+    first = false;
+  }
+  stream << "\n]}\n";
+  stream.flush();
+  discardTrace();
+  return file.error() == QFile::NoError;
+}
+
+void Profiler::discardTrace()
+{
+  State& s = state();
+  s.tracing = false;
+  s.events.clear();
+  s.counters.clear();
+}
+
+bool Profiler::isTracing()
+{
+  return state().tracing;
+}
+
+#endif // DIALOGUENODE_PROFILE
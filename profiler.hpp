@@ -0,0 +1,72 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+// Scoped timers and counters for the editor's hot paths. They are only built
+// with CONFIG+=profile, which defines DIALOGUENODE_PROFILE; otherwise the
+// macros below expand to nothing. Instrumented code must run on the GUI
+// thread.
+//
+//   PROFILE_SCOPE("Node::paint");   times the rest of the enclosing block
+//   PROFILE_COUNT("Cache misses");  counts without timing
+
+#ifdef DIALOGUENODE_PROFILE
+
+#include <QString>
+#include <QtGlobal>
+#include <vector>
+
+class Profiler
+{
+  public:
+    struct Site
+    {
+      Site(const char* name);
+
+      const char* name;
+      quint64 calls;
+      qint64 nanoseconds;
+      quint64 frameCalls;
+      qint64 frameNanoseconds;
+    };
+
+    class Scope
+    {
+      public:
+        Scope(Site& site);
+        ~Scope();
+
+      private:
+        Site& site;
+        qint64 start;
+    };
+
+    static qint64 now();
+    static void count(Site& site);
+    static const std::vector<Site*>& sites();
+
+    // Closes the current frame: the totals gathered since the last call
+    // become the frame totals shown by the overlay and written as counters
+    static void frame();
+
+    static void startTrace();
+    static bool stopTrace(const QString& fileName);
+    static void discardTrace();
+    static bool isTracing();
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) \
+  static Profiler::Site PROFILE_CONCAT(profileSite, __LINE__)(name); \
+  Profiler::Scope PROFILE_CONCAT(profileScope, __LINE__)(PROFILE_CONCAT(profileSite, __LINE__))
+#define PROFILE_COUNT(name) \
+  do { static Profiler::Site profileSite(name); Profiler::count(profileSite); } while (0)
+
+#else
+
+#define PROFILE_SCOPE(name)
+#define PROFILE_COUNT(name)
+
+#endif // DIALOGUENODE_PROFILE
+
+#endif // PROFILER_HPP
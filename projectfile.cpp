@@ -0,0 +1,315 @@
+#include "projectfile.hpp"
+#include "graph.hpp"
+#include <QSaveFile>
+#include <QFile>
+#include <QtEndian>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+using namespace ProjectFormat;
+
+static quint64 packReal(qreal value)
+{
+  double d = value;
+  quint64 bits;
+  std::memcpy(&bits, &d, sizeof(bits));
+  return qToLittleEndian(bits);
+}
+
+static qreal unpackReal(quint64 value)
+{
+  quint64 bits = qFromLittleEndian(value);
+  double d;
+  std::memcpy(&d, &bits, sizeof(d));
+  return d;
+}
+
+static bool inRange(quint64 offset, quint64 count, quint64 itemSize, quint64 total)
+{
+  return offset <= total && count * itemSize <= total - offset;
+}
+
+static bool writeData(QIODevice& device, const void* data, qint64 size)
+{
+  return device.write(reinterpret_cast<const char*>(data), size) == size;
+}
+
+static bool writeString(QIODevice& device, const QString& string)
+{
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+  return writeData(device, string.utf16(), qint64(string.size()) * 2);
+#else
+  for (QChar c : string)
+  {
+    quint16 unit = qToLittleEndian(c.unicode());
+    if (!writeData(device, &unit, 2))
+    {
+      return false;
+    }
+  }
+  return true;
+#endif
+}
+
+static QString readString(const uchar* pool, quint32 offset, quint32 length)
+{
+  const ushort* units = reinterpret_cast<const ushort*>(pool) + offset;
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+  return QString::fromUtf16(units, int(length));
+#else
+  QString string(int(length), Qt::Uninitialized);
+  for (quint32 i = 0; i < length; i++)
+  {
+    string[int(i)] = QChar(qFromLittleEndian(units[i]));
+  }
+  return string;
+#endif
+}
+
+ProjectFile::ProjectFile(const QString& fileName)
+  : fileName(fileName)
+{
+}
+
+bool ProjectFile::save(const DialogueGraph& graph)
+{
+  QSaveFile file(fileName);
+  if (!file.open(QIODevice::WriteOnly))
+  {
+    error = file.errorString();
+    return false;
+  }
+
+  // First pass only sizes things up so every section can be streamed in order.
+  // Removed nodes are skipped, so live nodes get compacted indices. The
+  // graph's string table is written as it is, each string once, and records
+  // point at the copy they share.
+  std::vector<quint32> index(graph.nodeCount(), NoNode);
+  quint32 nodeCount = 0;
+  quint64 connectionCount = 0;
+  for (NodeId node = 0; node < graph.nodeCount(); node++)
+  {
+    if (!graph.isAlive(node))
+    {
+      continue;
+    }
+    index[node] = nodeCount++;
+    connectionCount += graph.edgeCount(node);
+  }
+  std::vector<quint32> stringOffsets(graph.stringCount());
+  quint64 stringSize = 0;
+  for (StringId id = 0; id < graph.stringCount(); id++)
+  {
+    stringOffsets[id] = quint32(stringSize);
+    stringSize += quint64(graph.string(id).size());
+  }
+  if (connectionCount >= NoNode || stringSize >= NoNode)
+  {
+    error = tr("Project is too large to be saved");
+    return false;
+  }
+
+  Header header;
+  std::memcpy(header.magic, Magic, sizeof(header.magic));
+  header.version = qToLittleEndian(Version);
+  header.nodeCount = qToLittleEndian(nodeCount);
+  header.connectionCount = qToLittleEndian(quint32(connectionCount));
+  header.nodeOffset = sizeof(Header);
+  header.connectionOffset = header.nodeOffset + quint64(nodeCount) * sizeof(NodeRecord);
+  header.stringOffset = header.connectionOffset + connectionCount * sizeof(ConnectionRecord);
+  header.stringSize = stringSize;
+  header.nodeOffset = qToLittleEndian(header.nodeOffset);
+  header.connectionOffset = qToLittleEndian(header.connectionOffset);
+  header.stringOffset = qToLittleEndian(header.stringOffset);
+  header.stringSize = qToLittleEndian(header.stringSize);
+  bool ok = writeData(file, &header, sizeof(header));
+
+  quint32 connectionIndex = 0;
+  for (NodeId node = 0; node < graph.nodeCount(); node++)
+  {
+    if (!graph.isAlive(node))
+    {
+      continue;
+    }
+    NodeRecord record;
+    record.x = packReal(graph.position(node).x());
+    record.y = packReal(graph.position(node).y());
+    record.type = qToLittleEndian(kindInfo(graph.kind(node)).fileType);
+    record.text = qToLittleEndian(stringOffsets[graph.textId(node)]);
+    record.textLength = qToLittleEndian(quint32(graph.text(node).size()));
+    record.firstConnection = qToLittleEndian(connectionIndex);
+    record.connectionCount = qToLittleEndian(graph.edgeCount(node));
+    record.flags = qToLittleEndian(quint32(graph.isPinned(node) ? PinnedFlag : 0));
+    ok = ok && writeData(file, &record, sizeof(record));
+    connectionIndex += graph.edgeCount(node);
+  }
+
+  for (NodeId node = 0; node < graph.nodeCount(); node++)
+  {
+    if (!graph.isAlive(node))
+    {
+      continue;
+    }
+    for (quint32 slot = 0; slot < graph.edgeCount(node); slot++)
+    {
+      EdgeId edge = graph.edge(node, slot);
+      NodeId dest = graph.edgeTarget(edge);
+      ConnectionRecord record;
+      record.dest = qToLittleEndian(dest == NoId ? NoNode : index[dest]);
+      record.name = qToLittleEndian(stringOffsets[graph.edgeNameId(edge)]);
+      record.nameLength = qToLittleEndian(quint32(graph.edgeName(edge).size()));
+      record.reserved = 0;
+      ok = ok && writeData(file, &record, sizeof(record));
+    }
+  }
+
+  for (StringId id = 0; id < graph.stringCount(); id++)
+  {
+    ok = ok && writeString(file, graph.string(id));
+  }
+
+  if (!ok || !file.commit())
+  {
+    error = file.errorString();
+    return false;
+  }
+  return true;
+}
+
+bool ProjectFile::load(DialogueGraph& graph)
+{
+  QFile file(fileName);
+  if (!file.open(QIODevice::ReadOnly))
+  {
+    error = file.errorString();
+    return false;
+  }
+
+  const quint64 size = quint64(file.size());
+  const uchar* data = size >= sizeof(Header) ? file.map(0, file.size()) : 0;
+  if (!data)
+  {
+    error = tr("File is not a dialogue project");
+    return false;
+  }
+
+  const Header& header = *reinterpret_cast<const Header*>(data);
+  if (std::memcmp(header.magic, Magic, sizeof(header.magic)) != 0)
+  {
+    error = tr("File is not a dialogue project");
+    return false;
+  }
+  if (qFromLittleEndian(header.version) != Version)
+  {
+    error = tr("Unsupported project version %1").arg(qFromLittleEndian(header.version));
+    return false;
+  }
+
+  const quint32 nodeCount = qFromLittleEndian(header.nodeCount);
+  const quint32 connectionCount = qFromLittleEndian(header.connectionCount);
+  const quint64 nodeOffset = qFromLittleEndian(header.nodeOffset);
+  const quint64 connectionOffset = qFromLittleEndian(header.connectionOffset);
+  const quint64 stringOffset = qFromLittleEndian(header.stringOffset);
+  const quint64 stringSize = qFromLittleEndian(header.stringSize);
+  if (nodeOffset % 8 || connectionOffset % 8 || stringOffset % 2 ||
+      !inRange(nodeOffset, nodeCount, sizeof(NodeRecord), size) ||
+      !inRange(connectionOffset, connectionCount, sizeof(ConnectionRecord), size) ||
+      !inRange(stringOffset, stringSize, 2, size))
+  {
+    error = tr("Project file is corrupt");
+    return false;
+  }
+
+  const NodeRecord* nodeRecords = reinterpret_cast<const NodeRecord*>(data + nodeOffset);
+  const ConnectionRecord* connectionRecords = reinterpret_cast<const ConnectionRecord*>(data + connectionOffset);
+  const uchar* pool = data + stringOffset;
+  auto validString = [stringSize](quint32 offset, quint32 length)
+  {
+    return quint64(offset) + length <= stringSize;
+  };
+
+  // Records are consumed straight out of the mapping, nothing is staged.
+  // Nodes are added in file order so record indices are node handles. Saved
+  // strings are shared between records, so each is only decoded once.
+  DialogueGraph loaded;
+  std::unordered_map<quint64, StringId> strings;
+  bool ok = true;
+  for (quint32 i = 0; ok && i < nodeCount; i++)
+  {
+    const NodeRecord& record = nodeRecords[i];
+    const quint32 text = qFromLittleEndian(record.text);
+    const quint32 textLength = qFromLittleEndian(record.textLength);
+    const quint32 first = qFromLittleEndian(record.firstConnection);
+    const quint32 count = qFromLittleEndian(record.connectionCount);
+    NodeKind kind = TextKind;
+    ok = kindFromFileType(qFromLittleEndian(record.type), &kind) && validString(text, textLength) &&
+         quint64(first) + count <= connectionCount;
+    if (ok)
+    {
+      NodeId node = loaded.addNode(QPointF(unpackReal(record.x), unpackReal(record.y)), kind);
+      const quint64 textKey = (quint64(text) << 32) | textLength;
+      auto sharedText = strings.find(textKey);
+      if (sharedText != strings.end())
+      {
+        loaded.setTextId(node, sharedText->second);
+      }
+      else
+      {
+        loaded.setText(node, readString(pool, text, textLength));
+        strings[textKey] = loaded.textId(node);
+      }
+      loaded.setPinned(node, qFromLittleEndian(record.flags) & PinnedFlag);
+      for (quint32 slot = 0; ok && slot < count; slot++)
+      {
+        const ConnectionRecord& connection = connectionRecords[first + slot];
+        const quint32 name = qFromLittleEndian(connection.name);
+        const quint32 nameLength = qFromLittleEndian(connection.nameLength);
+        ok = validString(name, nameLength);
+        if (ok)
+        {
+          const quint64 nameKey = (quint64(name) << 32) | nameLength;
+          EdgeId edge = loaded.addEdge(node);
+          auto sharedName = strings.find(nameKey);
+          if (sharedName != strings.end())
+          {
+            loaded.setEdgeNameId(edge, sharedName->second);
+          }
+          else
+          {
+            loaded.setEdgeName(edge, readString(pool, name, nameLength));
+            strings[nameKey] = loaded.edgeNameId(edge);
+          }
+        }
+      }
+    }
+  }
+
+  for (quint32 i = 0; ok && i < nodeCount; i++)
+  {
+    const NodeRecord& record = nodeRecords[i];
+    const quint32 first = qFromLittleEndian(record.firstConnection);
+    for (quint32 slot = 0; ok && slot < loaded.edgeCount(i); slot++)
+    {
+      const quint32 dest = qFromLittleEndian(connectionRecords[first + slot].dest);
+      ok = dest == NoNode || dest < nodeCount;
+      if (ok && dest != NoNode)
+      {
+        loaded.setEdgeTarget(loaded.edge(i, slot), dest);
+      }
+    }
+  }
+
+  if (!ok)
+  {
+    error = tr("Project file is corrupt");
+    return false;
+  }
+  graph = std::move(loaded);
+  return true;
+}
+
+const QString& ProjectFile::errorString() const
+{
+  return error;
+}
@@ -0,0 +1,92 @@
+#ifndef PROJECTFILE_HPP
+#define PROJECTFILE_HPP
+
+#include <QCoreApplication>
+#include <QString>
+#include <QtGlobal>
+
+class DialogueGraph;
+
+// On-disk layout, all integers little-endian:
+//
+//   Header
+//   NodeRecord[nodeCount]
+//   ConnectionRecord[connectionCount]
+//   UTF-16LE string pool (stringSize code units)
+//
+// Records are fixed-size so a loader can index straight into a mapped file.
+// String references are offsets into the pool in UTF-16 code units; equal
+// strings are stored once and shared by every record using them.
+namespace ProjectFormat
+{
+  const char Magic[4] = {'D', 'L', 'G', 'N'};
+  const quint32 Version = 1;
+  const quint32 NoNode = 0xffffffffu;
+
+  enum NodeType
+  {
+    TextNodeType = 1,
+    ChoiceNodeType = 2,
+    ConditionNodeType = 3,
+    ScriptNodeType = 4,
+    JumpNodeType = 5
+  };
+
+  enum NodeFlags
+  {
+    PinnedFlag = 1
+  };
+
+  struct Header
+  {
+    char magic[4];
+    quint32 version;
+    quint32 nodeCount;
+    quint32 connectionCount;
+    quint64 nodeOffset;
+    quint64 connectionOffset;
+    quint64 stringOffset;
+    quint64 stringSize;
+  };
+
+  struct NodeRecord
+  {
+    quint64 x;
+    quint64 y;
+    quint32 type;
+    quint32 text;
+    quint32 textLength;
+    quint32 firstConnection;
+    quint32 connectionCount;
+    quint32 flags;
+  };
+
+  struct ConnectionRecord
+  {
+    quint32 dest;
+    quint32 name;
+    quint32 nameLength;
+    quint32 reserved;
+  };
+
+  static_assert(sizeof(Header) == 48, "Header must be tightly packed");
+  static_assert(sizeof(NodeRecord) == 40, "NodeRecord must be tightly packed");
+  static_assert(sizeof(ConnectionRecord) == 16, "ConnectionRecord must be tightly packed");
+}
+
+class ProjectFile
+{
+    Q_DECLARE_TR_FUNCTIONS(ProjectFile)
+  public:
+    ProjectFile(const QString& fileName);
+
+    bool save(const DialogueGraph& graph);
+    bool load(DialogueGraph& graph);
+    const QString& errorString() const;
+
+  private:
+    QString fileName;
+    QString error;
+};
+
+#endif // PROJECTFILE_HPP
@@ -0,0 +1,321 @@
+#ifndef DIALOGUERUNTIME_HPP
+#define DIALOGUERUNTIME_HPP
+
+// Header-only player for dialogue scripts exported by Dialogue Node.
+//
+// A Script is a read-only view over an exported buffer; it never copies or
+// allocates, so one loaded script can be shared by any number of threads.
+// A Conversation is just a script pointer and a node index, and stepping it
+// is a couple of array lookups.
+//
+// Records are read in place rather than decoded, so scripts can only be
+// played on little-endian hosts, which covers every current desktop, console
+// and phone CPU. Script::load() refuses to run anywhere else.
+//
+// Exported layout, all integers little-endian:
+//
+//   FileHeader
+//   NodeRecord[nodeCount]
+//   ChoiceRecord[choiceCount]
+//   StringRecord[stringCount]
+//   UTF-8 string data, each string followed by a NUL
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace DialogueRuntime
+{
+  const char Magic[4] = {'D', 'L', 'G', 'X'};
+  const uint32_t Version = 1;
+  const uint32_t End = 0xffffffffu;
+
+  // What the game does on reaching a node. Condition text is an expression
+  // for the game to test, choice 0 being true and 1 false; script text is a
+  // command to run before taking choice 0. Jump nodes are editor shorthand
+  // and are passed through by Conversation::skipJumps().
+  enum NodeKind
+  {
+    TextNode,
+    ChoiceNode,
+    ConditionNode,
+    ScriptNode,
+    JumpNode,
+    NodeKindCount
+  };
+
+  struct FileHeader
+  {
+    char magic[4];
+    uint32_t version;
+    uint32_t nodeCount;
+    uint32_t choiceCount;
+    uint32_t stringCount;
+    uint32_t stringDataSize;
+    uint32_t entry;
+    uint32_t reserved;
+  };
+
+  struct NodeRecord
+  {
+    uint32_t text;
+    uint32_t firstChoice;
+    uint32_t choiceCount;
+    uint32_t kind;
+  };
+
+  struct ChoiceRecord
+  {
+    uint32_t label;
+    uint32_t target;
+  };
+
+  struct StringRecord
+  {
+    uint32_t offset;
+    uint32_t length;
+  };
+
+  static_assert(sizeof(FileHeader) == 32, "FileHeader must be tightly packed");
+  static_assert(sizeof(NodeRecord) == 16, "NodeRecord must be tightly packed");
+  static_assert(sizeof(ChoiceRecord) == 8, "ChoiceRecord must be tightly packed");
+  static_assert(sizeof(StringRecord) == 8, "StringRecord must be tightly packed");
+
+  inline bool hostIsLittleEndian()
+  {
+    const uint32_t probe = 1;
+    unsigned char first;
+    std::memcpy(&first, &probe, 1);
+    return first == 1;
+  }
+
+  struct String
+  {
+    const char* data;
+    uint32_t length;
+  };
+
+  class Script
+  {
+    public:
+      Script()
+        : header(0)
+        , nodes(0)
+        , choices(0)
+        , strings(0)
+        , stringData(0)
+      {
+      }
+
+      // Validates the whole buffer once so stepping never has to. The buffer
+      // must stay alive and unchanged for as long as the script is used.
+      bool load(const void* buffer, size_t size)
+      {
+        *this = Script();
+        const char* data = static_cast<const char*>(buffer);
+        if (!hostIsLittleEndian() || size < sizeof(FileHeader) || reinterpret_cast<uintptr_t>(data) % 4)
+        {
+          return false;
+        }
+        // The version also marks the byte order: read the wrong way round it
+        // is 0x01000000 and the file is refused
+        const FileHeader* file = reinterpret_cast<const FileHeader*>(data);
+        if (std::memcmp(file->magic, Magic, sizeof(Magic)) != 0 || file->version != Version)
+        {
+          return false;
+        }
+
+        uint64_t offset = sizeof(FileHeader);
+        const uint64_t nodeOffset = offset;
+        offset += uint64_t(file->nodeCount) * sizeof(NodeRecord);
+        const uint64_t choiceOffset = offset;
+        offset += uint64_t(file->choiceCount) * sizeof(ChoiceRecord);
+        const uint64_t stringOffset = offset;
+        offset += uint64_t(file->stringCount) * sizeof(StringRecord);
+        const uint64_t stringDataOffset = offset;
+        offset += file->stringDataSize;
+        if (offset > size || (file->entry != End && file->entry >= file->nodeCount))
+        {
+          return false;
+        }
+
+        const NodeRecord* nodeTable = reinterpret_cast<const NodeRecord*>(data + nodeOffset);
+        const ChoiceRecord* choiceTable = reinterpret_cast<const ChoiceRecord*>(data + choiceOffset);
+        const StringRecord* stringTable = reinterpret_cast<const StringRecord*>(data + stringOffset);
+        const char* stringBytes = data + stringDataOffset;
+        for (uint32_t i = 0; i < file->stringCount; i++)
+        {
+          const StringRecord& string = stringTable[i];
+          if (uint64_t(string.offset) + string.length >= file->stringDataSize ||
+              stringBytes[string.offset + string.length] != '\0')
+          {
+            return false;
+          }
+        }
+        for (uint32_t i = 0; i < file->nodeCount; i++)
+        {
+          const NodeRecord& node = nodeTable[i];
+          if (node.text >= file->stringCount || node.kind >= NodeKindCount ||
+              uint64_t(node.firstChoice) + node.choiceCount > file->choiceCount)
+          {
+            return false;
+          }
+        }
+        for (uint32_t i = 0; i < file->choiceCount; i++)
+        {
+          const ChoiceRecord& choice = choiceTable[i];
+          if (choice.label >= file->stringCount || (choice.target != End && choice.target >= file->nodeCount))
+          {
+            return false;
+          }
+        }
+
+        header = file;
+        nodes = nodeTable;
+        choices = choiceTable;
+        strings = stringTable;
+        stringData = stringBytes;
+        return true;
+      }
+
+      bool isLoaded() const
+      {
+        return header != 0;
+      }
+
+      // A default start only: the first node in export order that nothing
+      // leads into. Scripts holding several conversations should start each
+      // one with Conversation(script, node).
+      uint32_t entry() const
+      {
+        return header->entry;
+      }
+
+      uint32_t nodeCount() const
+      {
+        return header->nodeCount;
+      }
+
+      const NodeRecord& node(uint32_t index) const
+      {
+        return nodes[index];
+      }
+
+      const ChoiceRecord& choice(uint32_t index) const
+      {
+        return choices[index];
+      }
+
+      String string(uint32_t index) const
+      {
+        String result = {stringData + strings[index].offset, strings[index].length};
+        return result;
+      }
+
+    private:
+      const FileHeader* header;
+      const NodeRecord* nodes;
+      const ChoiceRecord* choices;
+      const StringRecord* strings;
+      const char* stringData;
+  };
+
+  class Conversation
+  {
+    public:
+      Conversation()
+        : script(0)
+        , current(End)
+      {
+      }
+
+      explicit Conversation(const Script* script)
+        : script(script)
+        , current(script->isLoaded() ? script->entry() : End)
+      {
+      }
+
+      // A node that is not in the script starts a finished conversation
+      Conversation(const Script* script, uint32_t node)
+        : script(script)
+        , current(script->isLoaded() && node < script->nodeCount() ? node : End)
+      {
+      }
+
+      bool finished() const
+      {
+        return current == End;
+      }
+
+      uint32_t node() const
+      {
+        return current;
+      }
+
+      uint32_t kind() const
+      {
+        return script->node(current).kind;
+      }
+
+      String text() const
+      {
+        return script->string(script->node(current).text);
+      }
+
+      uint32_t choiceCount() const
+      {
+        return script->node(current).choiceCount;
+      }
+
+      String choiceLabel(uint32_t choice) const
+      {
+        const NodeRecord& node = script->node(current);
+        return script->string(script->choice(node.firstChoice + choice).label);
+      }
+
+      uint32_t choiceTarget(uint32_t choice) const
+      {
+        const NodeRecord& node = script->node(current);
+        return script->choice(node.firstChoice + choice).target;
+      }
+
+      // Follows a choice; out of range choices are ignored
+      bool choose(uint32_t choice)
+      {
+        if (current == End || choice >= choiceCount())
+        {
+          return false;
+        }
+        current = choiceTarget(choice);
+        return true;
+      }
+
+      // Moves to any node, or to End to finish; nodes that are not in the
+      // script are ignored
+      bool jump(uint32_t node)
+      {
+        if (node != End && node >= script->nodeCount())
+        {
+          return false;
+        }
+        current = node;
+        return true;
+      }
+
+      // Follows jump nodes until something else is reached; a loop made only
+      // of jumps ends the conversation
+      void skipJumps()
+      {
+        for (uint32_t hops = 0; current != End && kind() == JumpNode; hops++)
+        {
+          current = hops < script->nodeCount() && choiceCount() ? choiceTarget(0) : End;
+        }
+      }
+
+    private:
+      const Script* script;
+      uint32_t current;
+  };
+}
+
+#endif // DIALOGUERUNTIME_HPP
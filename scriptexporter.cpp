@@ -0,0 +1,147 @@
+#include "scriptexporter.hpp"
+#include "runtime/dialogueruntime.hpp"
+#include <QSaveFile>
+#include <QByteArray>
+#include <QtEndian>
+#include <cstring>
+#include <vector>
+
+using namespace DialogueRuntime;
+
+static bool writeData(QIODevice& device, const void* data, qint64 size)
+{
+  return device.write(reinterpret_cast<const char*>(data), size) == size;
+}
+
+ScriptExporter::ScriptExporter(const QString& fileName)
+  : fileName(fileName)
+{
+}
+
+bool ScriptExporter::save(const DialogueGraph& graph)
+{
+  QSaveFile file(fileName);
+  if (!file.open(QIODevice::WriteOnly))
+  {
+    error = file.errorString();
+    return false;
+  }
+  if (!write(file, graph) || !file.commit())
+  {
+    if (error.isEmpty())
+    {
+      error = file.errorString();
+    }
+    return false;
+  }
+  return true;
+}
+
+bool ScriptExporter::write(QIODevice& device, const DialogueGraph& graph, std::vector<NodeId>* order)
+{
+  // Sizing pass: compacts node indices and encodes the graph's string
+  // table, which is exported as it is so string ids carry straight over
+  error.clear();
+  std::vector<quint32> index(graph.nodeCount(), End);
+  std::vector<QByteArray> strings(graph.stringCount());
+  quint64 stringDataSize = 0;
+  for (StringId id = 0; id < graph.stringCount(); id++)
+  {
+    strings[id] = graph.string(id).toUtf8();
+    stringDataSize += quint64(strings[id].size()) + 1;
+  }
+  quint32 nodeCount = 0;
+  quint64 choiceCount = 0;
+  for (NodeId node = 0; node < graph.nodeCount(); node++)
+  {
+    if (!graph.isAlive(node))
+    {
+      continue;
+    }
+    index[node] = nodeCount++;
+    if (order)
+    {
+      order->push_back(node);
+    }
+    choiceCount += graph.edgeCount(node);
+  }
+  // Exported nodes keep graph order, so the entry is the first exported node
+  // nothing leads into
+  NodeId entryNode = graph.entry();
+  quint32 entry = entryNode == NoId ? End : index[entryNode];
+  if (choiceCount >= End || stringDataSize >= End)
+  {
+    error = tr("Dialogue is too large to be exported");
+    return false;
+  }
+
+  FileHeader header;
+  std::memcpy(header.magic, Magic, sizeof(header.magic));
+  header.version = qToLittleEndian(Version);
+  header.nodeCount = qToLittleEndian(nodeCount);
+  header.choiceCount = qToLittleEndian(quint32(choiceCount));
+  header.stringCount = qToLittleEndian(quint32(strings.size()));
+  header.stringDataSize = qToLittleEndian(quint32(stringDataSize));
+  header.entry = qToLittleEndian(entry);
+  header.reserved = 0;
+  bool ok = writeData(device, &header, sizeof(header));
+
+  quint32 firstChoice = 0;
+  for (NodeId node = 0; node < graph.nodeCount(); node++)
+  {
+    if (!graph.isAlive(node))
+    {
+      continue;
+    }
+    NodeRecord record;
+    record.text = qToLittleEndian(graph.textId(node));
+    record.firstChoice = qToLittleEndian(firstChoice);
+    record.choiceCount = qToLittleEndian(graph.edgeCount(node));
+    record.kind = qToLittleEndian(kindInfo(graph.kind(node)).runtimeKind);
+    ok = ok && writeData(device, &record, sizeof(record));
+    firstChoice += graph.edgeCount(node);
+  }
+
+  for (NodeId node = 0; node < graph.nodeCount(); node++)
+  {
+    if (!graph.isAlive(node))
+    {
+      continue;
+    }
+    for (quint32 slot = 0; slot < graph.edgeCount(node); slot++)
+    {
+      EdgeId edge = graph.edge(node, slot);
+      NodeId target = graph.edgeTarget(edge);
+      ChoiceRecord record;
+      record.label = qToLittleEndian(graph.edgeNameId(edge));
+      record.target = qToLittleEndian(target == NoId ? End : index[target]);
+      ok = ok && writeData(device, &record, sizeof(record));
+    }
+  }
+
+  quint32 offset = 0;
+  for (auto& string : strings)
+  {
+    StringRecord record;
+    record.offset = qToLittleEndian(offset);
+    record.length = qToLittleEndian(quint32(string.size()));
+    ok = ok && writeData(device, &record, sizeof(record));
+    offset += quint32(string.size()) + 1;
+  }
+  for (auto& string : strings)
+  {
+    ok = ok && writeData(device, string.constData(), string.size() + 1);
+  }
+
+  if (!ok)
+  {
+    error = device.errorString();
+    return false;
+  }
+  return true;
+}
+
+const QString& ScriptExporter::errorString() const
+{
+  return error;
+}
@@ -0,0 +1,29 @@
+#ifndef SCRIPTEXPORTER_HPP
+#define SCRIPTEXPORTER_HPP
+
+#include "graph.hpp"
+#include <QCoreApplication>
+#include <QString>
+#include <vector>
+
+class QIODevice;
+
+// Flattens a graph into the read-only format played back by
+// runtime/dialogueruntime.hpp. Removed nodes are dropped and every string is
+// stored once.
+class ScriptExporter
+{
+    Q_DECLARE_TR_FUNCTIONS(ScriptExporter)
+  public:
+    ScriptExporter(const QString& fileName = QString());
+
+    bool save(const DialogueGraph& graph);
+    bool write(QIODevice& device, const DialogueGraph& graph, std::vector<NodeId>* order = 0);
+    const QString& errorString() const;
+
+  private:
+    QString fileName;
+    QString error;
+};
+
+#endif // SCRIPTEXPORTER_HPP
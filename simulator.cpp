@@ -0,0 +1,194 @@
+#include "simulator.hpp"
+#include "scriptexporter.hpp"
+#include "mainwindow.hpp"
+#include "nodes.hpp"
+#include <QBuffer>
+#include <QLabel>
+#include <QListWidget>
+#include <QPushButton>
+#include <QVBoxLayout>
+#include <algorithm>
+#include <cstring>
+
+static QString toQString(DialogueRuntime::String string)
+{
+  return QString::fromUtf8(string.data, int(string.length));
+}
+
+Simulator::Simulator(DialogueView* view, QWidget* parent)
+  : QWidget(parent)
+  , view(view)
+{
+  textLabel = new QLabel(this);
+  textLabel->setWordWrap(true);
+  choiceList = new QListWidget(this);
+  stopButton = new QPushButton(tr("Stop"), this);
+  stopButton->setEnabled(false);
+  connect(choiceList, SIGNAL(itemClicked(QListWidgetItem*)), this, SLOT(choiceClicked(QListWidgetItem*)));
+  connect(stopButton, SIGNAL(clicked()), this, SLOT(stop()));
+
+  QVBoxLayout* layout = new QVBoxLayout(this);
+  layout->addWidget(textLabel);
+  layout->addWidget(choiceList);
+  layout->addWidget(stopButton);
+}
+
+bool Simulator::start(Node* node)
+{
+  stop();
+
+  QBuffer buffer;
+  buffer.open(QIODevice::WriteOnly);
+  ScriptExporter exporter;
+  std::vector<NodeId> order;
+  if (!exporter.write(buffer, *view->graph(), &order))
+  {
+    return false;
+  }
+  const QByteArray& bytes = buffer.data();
+  data.assign((size_t(bytes.size()) + 3) / 4, 0);
+  std::memcpy(data.data(), bytes.constData(), size_t(bytes.size()));
+  if (!script.load(data.data(), size_t(bytes.size())))
+  {
+    return false;
+  }
+
+  // Script nodes keep graph order, so the start node can be found by search
+  nodeIds.swap(order);
+  auto found = std::lower_bound(nodeIds.begin(), nodeIds.end(), node->id());
+  if (found == nodeIds.end() || *found != node->id())
+  {
+    stop();
+    return false;
+  }
+  conversation = DialogueRuntime::Conversation(&script, quint32(found - nodeIds.begin()));
+  visited.push_back(node->id());
+  passJumps();
+  stopButton->setEnabled(true);
+  highlight(true);
+  showCurrent();
+  return true;
+}
+
+bool Simulator::isRunning() const
+{
+  return !visited.empty();
+}
+
+void Simulator::stop()
+{
+  highlight(false);
+  visited.clear();
+  path.clear();
+  conversation = DialogueRuntime::Conversation();
+  script = DialogueRuntime::Script();
+  std::vector<quint32>().swap(data);
+  std::vector<NodeId>().swap(nodeIds);
+  textLabel->clear();
+  choiceList->clear();
+  stopButton->setEnabled(false);
+}
+
+void Simulator::choiceClicked(QListWidgetItem* item)
+{
+  choose(quint32(choiceList->row(item)));
+}
+
+void Simulator::choose(quint32 choice)
+{
+  if (!isRunning() || conversation.finished())
+  {
+    return;
+  }
+  if (choice >= conversation.choiceCount())
+  {
+    return;
+  }
+  step(choice);
+  passJumps();
+  highlight(true);
+  showCurrent();
+}
+
+void Simulator::step(quint32 choice)
+{
+  NodeId node = nodeIds[conversation.node()];
+  conversation.choose(choice);
+  path.push_back(view->graph()->edge(node, choice));
+  if (!conversation.finished())
+  {
+    visited.push_back(nodeIds[conversation.node()]);
+  }
+}
+
+void Simulator::passJumps()
+{
+  // Taken one at a time rather than with skipJumps() so each hop is shown
+  for (quint32 hops = 0; !conversation.finished() && conversation.kind() == DialogueRuntime::JumpNode; hops++)
+  {
+    if (hops == script.nodeCount() || conversation.choiceCount() == 0)
+    {
+      conversation.jump(DialogueRuntime::End);
+      break;
+    }
+    step(0);
+  }
+}
+
+void Simulator::showCurrent()
+{
+  choiceList->clear();
+  if (conversation.finished())
+  {
+    textLabel->setText(tr("End of conversation"));
+    return;
+  }
+
+  // The game decides conditions and runs scripts, here they are only shown
+  QString text = toQString(conversation.text());
+  if (conversation.kind() == DialogueRuntime::ConditionNode)
+  {
+    text = tr("If %1").arg(text);
+  }
+  else if (conversation.kind() == DialogueRuntime::ScriptNode)
+  {
+    text = tr("Run %1").arg(text);
+  }
+  textLabel->setText(text);
+  for (quint32 i = 0; i < conversation.choiceCount(); i++)
+  {
+    QString label = toQString(conversation.choiceLabel(i));
+    if (conversation.choiceTarget(i) == DialogueRuntime::End)
+    {
+      label = tr("%1 (ends)").arg(label);
+    }
+    choiceList->addItem(label);
+  }
+
+  Node* item = view->nodeItem(nodeIds[conversation.node()]);
+  if (item)
+  {
+    view->ensureVisible(item);
+  }
+}
+
+void Simulator::highlight(bool on)
+{
+  DialogueGraph* graph = view->graph();
+  for (auto id : visited)
+  {
+    Node* node = view->nodeItem(id);
+    if (node)
+    {
+      node->setHighlighted(on);
+    }
+  }
+  for (auto edge : path)
+  {
+    Node* source = view->nodeItem(graph->edgeSource(edge));
+    if (source)
+    {
+      source->setConnectionHighlighted(int(graph->edgeSlot(edge)), on);
+    }
+  }
+}
@@ -0,0 +1,54 @@
+#ifndef SIMULATOR_HPP
+#define SIMULATOR_HPP
+
+#include "graph.hpp"
+#include "runtime/dialogueruntime.hpp"
+#include <QWidget>
+#include <vector>
+
+class QLabel;
+class QListWidget;
+class QListWidgetItem;
+class QPushButton;
+class DialogueView;
+class Node;
+
+// Plays the document with the same runtime a game uses. The graph is
+// compiled once when playback starts; each step after that is a cursor move
+// plus a handle lookup to highlight the path taken.
+class Simulator : public QWidget
+{
+    Q_OBJECT
+  public:
+    Simulator(DialogueView* view, QWidget* parent = 0);
+
+    bool start(Node* node);
+    bool isRunning() const;
+
+  public slots:
+    void stop();
+
+  private slots:
+    void choiceClicked(QListWidgetItem* item);
+
+  private:
+    void choose(quint32 choice);
+    void step(quint32 choice);
+    void passJumps();
+    void showCurrent();
+    void highlight(bool on);
+
+    DialogueView* view;
+    std::vector<quint32> data;
+    std::vector<NodeId> nodeIds;
+    DialogueRuntime::Script script;
+    DialogueRuntime::Conversation conversation;
+    std::vector<NodeId> visited;
+    std::vector<EdgeId> path;
+
+    QLabel* textLabel;
+    QListWidget* choiceList;
+    QPushButton* stopButton;
+};
+
+#endif // SIMULATOR_HPP
@@ -0,0 +1,302 @@
+#include "spatialgrid.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+SpatialGrid::SpatialGrid(qreal cellSize)
+  : cellSize(cellSize)
+  , count(0)
+  , stamp(0)
+  , extentStale(false)
+{
+  std::fill(extremes, extremes + 4, NoId);
+}
+
+void SpatialGrid::clear()
+{
+  cells.clear();
+  boxes.clear();
+  ranges.clear();
+  present.clear();
+  stamps.clear();
+  count = 0;
+  extentStale = false;
+  std::fill(extremes, extremes + 4, NoId);
+}
+
+void SpatialGrid::update(NodeId node, const QRectF& box)
+{
+  if (node >= present.size())
+  {
+    boxes.resize(node + 1);
+    ranges.resize(node + 1);
+    present.resize(node + 1, false);
+    stamps.resize(node + 1, 0);
+  }
+  Range cellRange = range(box);
+  if (!extentStale)
+  {
+    // A side's extreme node moving inward may leave another node furthest
+    // out, which only a rescan can find
+    const QRectF& old = boxes[node];
+    bool inward = (extremes[Left] == node && box.left() > old.left())
+        || (extremes[Top] == node && box.top() > old.top())
+        || (extremes[Right] == node && box.right() < old.right())
+        || (extremes[Bottom] == node && box.bottom() < old.bottom());
+    if (present[node] && inward)
+    {
+      extentStale = true;
+    }
+    else if (count == 0 || (count == 1 && present[node]))
+    {
+      extent[Left] = box.left();
+      extent[Top] = box.top();
+      extent[Right] = box.right();
+      extent[Bottom] = box.bottom();
+      std::fill(extremes, extremes + 4, node);
+    }
+    else
+    {
+      extend(node, box);
+    }
+  }
+  if (present[node])
+  {
+    const Range& old = ranges[node];
+    if (old.left != cellRange.left || old.top != cellRange.top || old.right != cellRange.right || old.bottom != cellRange.bottom)
+    {
+      removeCells(node, old);
+      insertCells(node, cellRange);
+    }
+  }
+  else
+  {
+    insertCells(node, cellRange);
+    present[node] = true;
+    count++;
+  }
+  boxes[node] = box;
+  ranges[node] = cellRange;
+}
+
+void SpatialGrid::remove(NodeId node)
+{
+  if (contains(node))
+  {
+    if (std::find(extremes, extremes + 4, node) != extremes + 4)
+    {
+      extentStale = true;
+    }
+    removeCells(node, ranges[node]);
+    present[node] = false;
+    count--;
+  }
+}
+
+bool SpatialGrid::contains(NodeId node) const
+{
+  return node < present.size() && present[node];
+}
+
+QRectF SpatialGrid::box(NodeId node) const
+{
+  return contains(node) ? boxes[node] : QRectF();
+}
+
+quint32 SpatialGrid::size() const
+{
+  return count;
+}
+
+std::vector<NodeId> SpatialGrid::query(const QRectF& rect) const
+{
+  // Nodes spanning several cells are reported once, using a stamp per node
+  // rather than clearing a visited set on every query
+  std::vector<NodeId> result;
+  if (++stamp == 0)
+  {
+    std::fill(stamps.begin(), stamps.end(), 0);
+    stamp = 1;
+  }
+  auto visit = [&](const std::vector<NodeId>& nodes)
+  {
+    for (auto node : nodes)
+    {
+      if (stamps[node] != stamp)
+      {
+        stamps[node] = stamp;
+        if (boxes[node].intersects(rect))
+        {
+          result.push_back(node);
+        }
+      }
+    }
+  };
+
+  // Large areas over a sparse grid walk the stored cells instead
+  Range cellRange = range(rect);
+  qint64 area = qint64(cellRange.right - cellRange.left + 1) * (cellRange.bottom - cellRange.top + 1);
+  if (area > qint64(cells.size()))
+  {
+    for (auto& cell : cells)
+    {
+      qint32 x = qint32(cell.first >> 32);
+      qint32 y = qint32(quint32(cell.first));
+      if (x >= cellRange.left && x <= cellRange.right && y >= cellRange.top && y <= cellRange.bottom)
+      {
+        visit(cell.second);
+      }
+    }
+    return result;
+  }
+  for (qint32 y = cellRange.top; y <= cellRange.bottom; y++)
+  {
+    for (qint32 x = cellRange.left; x <= cellRange.right; x++)
+    {
+      auto cell = cells.find(key(x, y));
+      if (cell != cells.end())
+      {
+        visit(cell->second);
+      }
+    }
+  }
+  return result;
+}
+
+NodeId SpatialGrid::at(const QPointF& point) const
+{
+  auto cell = cells.find(key(qint32(std::floor(point.x() / cellSize)), qint32(std::floor(point.y() / cellSize))));
+  if (cell == cells.end())
+  {
+    return NoId;
+  }
+  for (auto node : cell->second)
+  {
+    if (boxes[node].contains(point))
+    {
+      return node;
+    }
+  }
+  return NoId;
+}
+
+QRectF SpatialGrid::bounds() const
+{
+  if (count == 0)
+  {
+    return QRectF();
+  }
+  if (extentStale)
+  {
+    rescan();
+  }
+  return QRectF(QPointF(extent[Left], extent[Top]), QPointF(extent[Right], extent[Bottom]));
+}
+
+quint64 SpatialGrid::key(qint32 x, qint32 y)
+{
+  return (quint64(quint32(x)) << 32) | quint32(y);
+}
+
+SpatialGrid::Range SpatialGrid::range(const QRectF& rect) const
+{
+  Range cellRange;
+  cellRange.left = qint32(std::floor(rect.left() / cellSize));
+  cellRange.top = qint32(std::floor(rect.top() / cellSize));
+  cellRange.right = qint32(std::floor(rect.right() / cellSize));
+  cellRange.bottom = qint32(std::floor(rect.bottom() / cellSize));
+  return cellRange;
+}
+
+void SpatialGrid::insertCells(NodeId node, const Range& cellRange)
+{
+  for (qint32 y = cellRange.top; y <= cellRange.bottom; y++)
+  {
+    for (qint32 x = cellRange.left; x <= cellRange.right; x++)
+    {
+      cells[key(x, y)].push_back(node);
+    }
+  }
+}
+
+void SpatialGrid::removeCells(NodeId node, const Range& cellRange)
+{
+  for (qint32 y = cellRange.top; y <= cellRange.bottom; y++)
+  {
+    for (qint32 x = cellRange.left; x <= cellRange.right; x++)
+    {
+      auto cell = cells.find(key(x, y));
+      if (cell == cells.end())
+      {
+        continue;
+      }
+      std::vector<NodeId>& nodes = cell->second;
+      auto found = std::find(nodes.begin(), nodes.end(), node);
+      if (found != nodes.end())
+      {
+        *found = nodes.back();
+        nodes.pop_back();
+      }
+      if (nodes.empty())
+      {
+        cells.erase(cell);
+      }
+    }
+  }
+}
+
+void SpatialGrid::extend(NodeId node, const QRectF& box) const
+{
+  if (box.left() <= extent[Left])
+  {
+    extent[Left] = box.left();
+    extremes[Left] = node;
+  }
+  if (box.top() <= extent[Top])
+  {
+    extent[Top] = box.top();
+    extremes[Top] = node;
+  }
+  if (box.right() >= extent[Right])
+  {
+    extent[Right] = box.right();
+    extremes[Right] = node;
+  }
+  if (box.bottom() >= extent[Bottom])
+  {
+    extent[Bottom] = box.bottom();
+    extremes[Bottom] = node;
+  }
+}
+
+void SpatialGrid::rescan() const
+{
+  // Whatever reaches furthest out is listed in the outermost cells, so only
+  // those need their boxes checked
+  Range outer = { std::numeric_limits<qint32>::max(), std::numeric_limits<qint32>::max(),
+                  std::numeric_limits<qint32>::min(), std::numeric_limits<qint32>::min() };
+  for (auto& cell : cells)
+  {
+    qint32 x = qint32(cell.first >> 32);
+    qint32 y = qint32(quint32(cell.first));
+    outer.left = std::min(outer.left, x);
+    outer.right = std::max(outer.right, x);
+    outer.top = std::min(outer.top, y);
+    outer.bottom = std::max(outer.bottom, y);
+  }
+  extent[Left] = extent[Top] = std::numeric_limits<qreal>::max();
+  extent[Right] = extent[Bottom] = -std::numeric_limits<qreal>::max();
+  for (auto& cell : cells)
+  {
+    qint32 x = qint32(cell.first >> 32);
+    qint32 y = qint32(quint32(cell.first));
+    if (x == outer.left || x == outer.right || y == outer.top || y == outer.bottom)
+    {
+      for (auto node : cell.second)
+      {
+        extend(node, boxes[node]);
+      }
+    }
+  }
+  extentStale = false;
+}
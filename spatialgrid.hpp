@@ -0,0 +1,70 @@
+#ifndef SPATIALGRID_HPP
+#define SPATIALGRID_HPP
+
+#include "graph.hpp"
+#include <QPointF>
+#include <QRectF>
+#include <unordered_map>
+#include <vector>
+
+// Uniform grid over node boxes in scene coordinates. Nodes are listed in
+// every cell their box touches, so moving one only rewrites the few cells
+// it leaves and enters, and queries only look at the cells they cover.
+// Only cells that hold something are stored.
+//
+// The overall bounds are kept with the node furthest out on each side, so
+// they only need a rescan once one of those nodes moves inward or leaves.
+class SpatialGrid
+{
+  public:
+    SpatialGrid(qreal cellSize = 256);
+
+    void clear();
+    void update(NodeId node, const QRectF& box);
+    void remove(NodeId node);
+    bool contains(NodeId node) const;
+    QRectF box(NodeId node) const;
+    quint32 size() const;
+
+    std::vector<NodeId> query(const QRectF& rect) const;
+    NodeId at(const QPointF& point) const;
+    QRectF bounds() const;
+
+  private:
+    enum Side
+    {
+      Left,
+      Top,
+      Right,
+      Bottom
+    };
+
+    struct Range
+    {
+      qint32 left;
+      qint32 top;
+      qint32 right;
+      qint32 bottom;
+    };
+
+    static quint64 key(qint32 x, qint32 y);
+    Range range(const QRectF& rect) const;
+    void insertCells(NodeId node, const Range& cells);
+    void removeCells(NodeId node, const Range& cells);
+    void extend(NodeId node, const QRectF& box) const;
+    void rescan() const;
+
+    qreal cellSize;
+    quint32 count;
+    std::unordered_map<quint64, std::vector<NodeId>> cells;
+    std::vector<QRectF> boxes;
+    std::vector<Range> ranges;
+    std::vector<bool> present;
+    mutable std::vector<quint32> stamps;
+    mutable quint32 stamp;
+    mutable qreal extent[4];
+    mutable NodeId extremes[4];
+    mutable bool extentStale;
+};
+
+#endif // SPATIALGRID_HPP
@@ -0,0 +1,486 @@
+#include "graph.hpp"
+#include "analysis.hpp"
+#include "projectfile.hpp"
+#include "scriptexporter.hpp"
+#include "spatialgrid.hpp"
+#include "runtime/dialogueruntime.hpp"
+#include <QtTest>
+#include <QBuffer>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QtEndian>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+static std::vector<NodeId> incoming(const DialogueGraph& graph, NodeId node)
+{
+  std::vector<NodeId> sources;
+  for (EdgeId edge = graph.firstIncoming(node); edge != NoId; edge = graph.nextIncoming(edge))
+  {
+    sources.push_back(graph.edgeSource(edge));
+  }
+  std::sort(sources.begin(), sources.end());
+  return sources;
+}
+
+// Two conversations meeting at a shared node, a loose node and every kind
+static DialogueGraph sampleGraph()
+{
+  DialogueGraph graph;
+  NodeId greet = graph.addNode(QPointF(0, 0));
+  NodeId ask = graph.addNode(QPointF(200, 0), ChoiceKind);
+  NodeId test = graph.addNode(QPointF(400, 0), ConditionKind);
+  NodeId run = graph.addNode(QPointF(600, 0), ScriptKind);
+  NodeId jump = graph.addNode(QPointF(0, 200), JumpKind);
+  NodeId loose = graph.addNode(QPointF(0, 400));
+  graph.setText(greet, "Hello");
+  graph.setText(ask, "Hello");
+  graph.setText(test, "has_key");
+  graph.setText(run, "open_door");
+  graph.setText(loose, "Next");
+  graph.setPinned(ask, true);
+  graph.setEdgeTarget(graph.addEdge(greet, "Next"), ask);
+  graph.setEdgeTarget(graph.addEdge(ask, "Yes"), test);
+  graph.addEdge(ask, "No");
+  graph.setEdgeTarget(graph.addEdge(test, "True"), run);
+  graph.addEdge(test, "False");
+  graph.addEdge(run, "Next");
+  graph.setEdgeTarget(graph.addEdge(jump, "Target"), ask);
+  Q_UNUSED(loose);
+  return graph;
+}
+
+static void writeAt(const QString& fileName, qint64 offset, quint32 value)
+{
+  QFile file(fileName);
+  QVERIFY(file.open(QIODevice::ReadWrite));
+  QVERIFY(file.seek(offset));
+  value = qToLittleEndian(value);
+  QCOMPARE(file.write(reinterpret_cast<const char*>(&value), sizeof(value)), qint64(sizeof(value)));
+}
+
+class CoreTest : public QObject
+{
+    Q_OBJECT
+
+  private slots:
+    void incomingLists();
+    void relocatedEdges();
+    void releasedNodes();
+    void internedStrings();
+    void multipleRoots();
+    void trappedCycles();
+    void trappedCyclesThreaded();
+    void roundTrip();
+    void corruptFile_data();
+    void corruptFile();
+    void exportedScript();
+    void corruptScript_data();
+    void corruptScript();
+    void spatialGrid();
+};
+
+void CoreTest::incomingLists()
+{
+  DialogueGraph graph;
+  NodeId a = graph.addNode();
+  NodeId b = graph.addNode();
+  NodeId c = graph.addNode();
+  EdgeId ab = graph.addEdge(a);
+  EdgeId cb = graph.addEdge(c);
+  graph.setEdgeTarget(ab, b);
+  graph.setEdgeTarget(cb, b);
+  QCOMPARE(graph.incomingCount(b), 2u);
+  QCOMPARE(incoming(graph, b), (std::vector<NodeId>{a, c}));
+
+  graph.setEdgeTarget(ab, c);
+  QCOMPARE(incoming(graph, b), std::vector<NodeId>{c});
+  QCOMPARE(incoming(graph, c), std::vector<NodeId>{a});
+  graph.setEdgeTarget(cb, NoId);
+  QCOMPARE(graph.incomingCount(b), 0u);
+  QCOMPARE(graph.firstIncoming(b), NoId);
+  QCOMPARE(graph.edgeSlot(cb), 0u);
+}
+
+void CoreTest::relocatedEdges()
+{
+  // Growing a node whose run is not at the end moves it, links included
+  DialogueGraph graph;
+  NodeId a = graph.addNode();
+  NodeId b = graph.addNode();
+  graph.setEdgeTarget(graph.addEdge(a, "First"), b);
+  graph.setEdgeTarget(graph.addEdge(b, "Back"), a);
+  EdgeId second = graph.addEdge(a, "Second");
+  graph.setEdgeTarget(second, b);
+
+  QCOMPARE(graph.edgeCount(a), 2u);
+  QCOMPARE(graph.edgeName(graph.edge(a, 0)), QString("First"));
+  QCOMPARE(graph.edgeTarget(graph.edge(a, 0)), b);
+  QCOMPARE(graph.edgeSlot(second), 1u);
+  QCOMPARE(graph.incomingCount(b), 2u);
+  QCOMPARE(incoming(graph, b), (std::vector<NodeId>{a, a}));
+  QCOMPARE(incoming(graph, a), std::vector<NodeId>{b});
+
+  // The run a left behind goes to the next node that fits in it
+  NodeId c = graph.addNode();
+  EdgeId reused = graph.addEdge(c, "Reused");
+  QCOMPARE(reused, EdgeId(0));
+  graph.setEdgeTarget(reused, a);
+  QCOMPARE(graph.edgeSource(reused), c);
+  QCOMPARE(incoming(graph, a), (std::vector<NodeId>{b, c}));
+  QCOMPARE(incoming(graph, b), (std::vector<NodeId>{a, a}));
+}
+
+void CoreTest::releasedNodes()
+{
+  DialogueGraph graph;
+  NodeId a = graph.addNode();
+  NodeId b = graph.addNode(QPointF(), JumpKind);
+  graph.setText(b, "Gone");
+  graph.setEdgeTarget(graph.addEdge(a), b);
+  graph.setEdgeTarget(graph.addEdge(b, "Back"), a);
+
+  graph.removeNode(b);
+  QVERIFY(!graph.isAlive(b));
+  QCOMPARE(graph.aliveCount(), 1u);
+  QCOMPARE(graph.edgeTarget(graph.edge(a, 0)), NoId);
+  QCOMPARE(graph.incomingCount(a), 0u);
+
+  graph.restoreNode(b);
+  QVERIFY(graph.isAlive(b));
+  QCOMPARE(graph.text(b), QString("Gone"));
+
+  graph.removeNode(b);
+  graph.releaseNode(b);
+  NodeId reused = graph.addNode();
+  QCOMPARE(reused, b);
+  QCOMPARE(graph.kind(reused), TextKind);
+  QCOMPARE(graph.textId(reused), EmptyString);
+  QCOMPARE(graph.edgeCount(reused), 0u);
+}
+
+void CoreTest::internedStrings()
+{
+  DialogueGraph graph;
+  NodeId a = graph.addNode();
+  NodeId b = graph.addNode();
+  graph.setText(a, "Goodbye");
+  graph.setText(b, "Goodbye");
+  EdgeId edge = graph.addEdge(a, "Goodbye");
+  QVERIFY(graph.textId(a) != EmptyString);
+  QCOMPARE(graph.textId(b), graph.textId(a));
+  QCOMPARE(graph.edgeNameId(edge), graph.textId(a));
+  QCOMPARE(graph.stringCount(), 2u);
+
+  // Dropped once the last reference goes, then the slot is reused
+  StringId goodbye = graph.textId(a);
+  graph.setText(a, "Hi");
+  graph.setText(b, "Hi");
+  QCOMPARE(graph.string(goodbye), QString("Goodbye"));
+  graph.setEdgeName(edge, "Continue");
+  QCOMPARE(graph.string(goodbye), QString());
+  graph.setText(b, "Farewell");
+  QCOMPARE(graph.textId(b), goodbye);
+  QCOMPARE(graph.text(b), QString("Farewell"));
+
+  // Copies keep their own table once changed
+  DialogueGraph copy = graph;
+  copy.setText(a, "Changed");
+  QCOMPARE(graph.text(a), QString("Hi"));
+  QCOMPARE(copy.text(a), QString("Changed"));
+
+  graph.removeNode(a);
+  graph.releaseNode(a);
+  QCOMPARE(graph.text(b), QString("Farewell"));
+  graph.clear();
+  QCOMPARE(graph.stringCount(), 1u);
+}
+
+void CoreTest::multipleRoots()
+{
+  DialogueGraph graph = sampleGraph();
+  GraphReport report = GraphAnalysis(graph, 1).run();
+  QCOMPARE(report.entry, NodeId(0));
+  QCOMPARE(report.roots, (std::vector<NodeId>{0, 4, 5}));
+  QCOMPARE(report.loose, std::vector<NodeId>{5});
+  QVERIFY(report.unreachable.empty());
+  QCOMPARE(report.dangling.size(), size_t(3));
+  QVERIFY(report.trappedCycles.empty());
+
+  // Loose nodes are roots, never unreachable, and alone enable deleting
+  QVERIFY(report.hasLoose());
+  graph.setEdgeTarget(graph.addEdge(5), 0);
+  report = GraphAnalysis(graph, 1).run();
+  QVERIFY(report.loose.empty());
+  QVERIFY(!report.hasLoose());
+}
+
+void CoreTest::trappedCycles()
+{
+  // b and c only lead to each other; d and e loop too but d can leave
+  DialogueGraph graph;
+  NodeId a = graph.addNode();
+  NodeId b = graph.addNode();
+  NodeId c = graph.addNode();
+  NodeId d = graph.addNode();
+  NodeId e = graph.addNode();
+  NodeId end = graph.addNode();
+  graph.setEdgeTarget(graph.addEdge(a), b);
+  graph.setEdgeTarget(graph.addEdge(a), d);
+  graph.setEdgeTarget(graph.addEdge(b), c);
+  graph.setEdgeTarget(graph.addEdge(c), b);
+  graph.setEdgeTarget(graph.addEdge(d), e);
+  graph.setEdgeTarget(graph.addEdge(d), end);
+  graph.setEdgeTarget(graph.addEdge(e), d);
+
+  GraphReport report = GraphAnalysis(graph, 1).run();
+  QCOMPARE(report.trappedCycles.size(), size_t(1));
+  QCOMPARE(report.trappedCycles.front(), (std::vector<NodeId>{b, c}));
+  QVERIFY(report.unreachable.empty());
+  QVERIFY(!report.isClean());
+
+  // With no way in at all, the loop is unreachable as well as trapped
+  graph.setEdgeTarget(graph.edge(a, 0), NoId);
+  report = GraphAnalysis(graph, 1).run();
+  QCOMPARE(report.unreachable, (std::vector<NodeId>{b, c}));
+  QCOMPARE(report.trappedCycles.size(), size_t(1));
+}
+
+void CoreTest::trappedCyclesThreaded()
+{
+  // Large enough for the passes to be split across threads
+  const quint32 count = 20000;
+  DialogueGraph graph;
+  for (quint32 i = 0; i < count; i++)
+  {
+    graph.addNode();
+  }
+  for (NodeId node = 0; node + 1 < count; node++)
+  {
+    graph.setEdgeTarget(graph.addEdge(node), node + 1);
+  }
+  graph.setEdgeTarget(graph.addEdge(count - 1), count - 100);
+  NodeId stray = graph.addNode();
+  graph.setEdgeTarget(graph.addEdge(stray), stray);
+
+  GraphReport single = GraphAnalysis(graph, 1).run();
+  GraphReport threaded = GraphAnalysis(graph, 4).run();
+  QCOMPARE(single.trappedCycles.size(), size_t(2));
+  QCOMPARE(single.trappedCycles[0].size(), size_t(100));
+  QCOMPARE(threaded.trappedCycles, single.trappedCycles);
+  QCOMPARE(threaded.unreachable, std::vector<NodeId>{stray});
+  QCOMPARE(threaded.unreachable, single.unreachable);
+}
+
+void CoreTest::roundTrip()
+{
+  DialogueGraph graph = sampleGraph();
+  NodeId removed = graph.addNode();
+  graph.setText(removed, "Removed");
+  graph.removeNode(removed);
+
+  QTemporaryDir dir;
+  QString name = dir.filePath("round.dlgn");
+  QVERIFY(ProjectFile(name).save(graph));
+  DialogueGraph loaded;
+  ProjectFile file(name);
+  QVERIFY2(file.load(loaded), qPrintable(file.errorString()));
+
+  QCOMPARE(loaded.nodeCount(), graph.aliveCount());
+  for (NodeId node = 0; node < loaded.nodeCount(); node++)
+  {
+    QCOMPARE(loaded.kind(node), graph.kind(node));
+    QCOMPARE(loaded.position(node), graph.position(node));
+    QCOMPARE(loaded.text(node), graph.text(node));
+    QCOMPARE(loaded.isPinned(node), graph.isPinned(node));
+    QCOMPARE(loaded.edgeCount(node), graph.edgeCount(node));
+    for (quint32 slot = 0; slot < loaded.edgeCount(node); slot++)
+    {
+      QCOMPARE(loaded.edgeName(loaded.edge(node, slot)), graph.edgeName(graph.edge(node, slot)));
+      QCOMPARE(loaded.edgeTarget(loaded.edge(node, slot)), graph.edgeTarget(graph.edge(node, slot)));
+    }
+  }
+
+  // Shared strings stay shared, and the pool is the graph's table as it is
+  QCOMPARE(loaded.textId(1), loaded.textId(0));
+  QCOMPARE(loaded.edgeNameId(loaded.edge(0, 0)), loaded.textId(5));
+  QCOMPARE(loaded.edgeNameId(loaded.edge(3, 0)), loaded.textId(5));
+  quint64 expected = 0;
+  for (StringId id = 0; id < graph.stringCount(); id++)
+  {
+    expected += quint64(graph.string(id).size());
+  }
+  QFile saved(name);
+  QVERIFY(saved.open(QIODevice::ReadOnly));
+  ProjectFormat::Header header;
+  QCOMPARE(saved.read(reinterpret_cast<char*>(&header), sizeof(header)), qint64(sizeof(header)));
+  QCOMPARE(qFromLittleEndian(header.stringSize), expected);
+}
+
+void CoreTest::corruptFile_data()
+{
+  // Each row breaks one thing in a freshly saved file: a 32-bit value
+  // written at an offset, or the file cut short
+  QTest::addColumn<qint64>("offset");
+  QTest::addColumn<quint32>("value");
+  QTest::addColumn<qint64>("truncate");
+
+  const qint64 nodes = sizeof(ProjectFormat::Header);
+  const qint64 connections = nodes + 6 * sizeof(ProjectFormat::NodeRecord);
+  QTest::newRow("magic") << qint64(0) << quint32(0x58585858) << qint64(-1);
+  QTest::newRow("version") << qint64(4) << quint32(2) << qint64(-1);
+  QTest::newRow("node count") << qint64(8) << quint32(1000) << qint64(-1);
+  QTest::newRow("string offset") << qint64(32) << quint32(0x7ffffff0) << qint64(-1);
+  QTest::newRow("string size") << qint64(40) << quint32(0x7ffffff0) << qint64(-1);
+  QTest::newRow("node type") << nodes + 16 << quint32(99) << qint64(-1);
+  QTest::newRow("text range") << nodes + 24 << quint32(1000) << qint64(-1);
+  QTest::newRow("connection range") << nodes + 28 << quint32(1000) << qint64(-1);
+  QTest::newRow("connection target") << connections << quint32(1000) << qint64(-1);
+  QTest::newRow("short header") << qint64(0) << quint32(0) << qint64(20);
+  QTest::newRow("short records") << qint64(0) << quint32(0) << nodes + 50;
+}
+
+void CoreTest::corruptFile()
+{
+  QFETCH(qint64, offset);
+  QFETCH(quint32, value);
+  QFETCH(qint64, truncate);
+
+  QTemporaryDir dir;
+  QString name = dir.filePath("corrupt.dlgn");
+  QVERIFY(ProjectFile(name).save(sampleGraph()));
+  if (truncate >= 0)
+  {
+    QVERIFY(QFile::resize(name, truncate));
+  }
+  else
+  {
+    writeAt(name, offset, value);
+  }
+
+  // A failed load leaves the document as it was
+  DialogueGraph graph;
+  graph.setText(graph.addNode(), "Untouched");
+  ProjectFile file(name);
+  QVERIFY(!file.load(graph));
+  QVERIFY(!file.errorString().isEmpty());
+  QCOMPARE(graph.nodeCount(), 1u);
+  QCOMPARE(graph.text(0), QString("Untouched"));
+}
+
+void CoreTest::exportedScript()
+{
+  DialogueGraph graph = sampleGraph();
+  QBuffer buffer;
+  buffer.open(QIODevice::WriteOnly);
+  ScriptExporter exporter;
+  QVERIFY(exporter.write(buffer, graph));
+  std::vector<quint32> data((size_t(buffer.size()) + 3) / 4);
+  std::memcpy(data.data(), buffer.data().constData(), size_t(buffer.size()));
+
+  using namespace DialogueRuntime;
+  Script script;
+  QVERIFY(script.load(data.data(), size_t(buffer.size())));
+  QCOMPARE(script.nodeCount(), 6u);
+  QCOMPARE(script.entry(), 0u);
+
+  Conversation conversation(&script);
+  QCOMPARE(conversation.kind(), uint32_t(TextNode));
+  QCOMPARE(QString::fromUtf8(conversation.text().data), QString("Hello"));
+  QVERIFY(conversation.choose(0));
+  QCOMPARE(conversation.kind(), uint32_t(ChoiceNode));
+  QCOMPARE(conversation.choiceCount(), 2u);
+  QCOMPARE(QString::fromUtf8(conversation.choiceLabel(1).data), QString("No"));
+  QVERIFY(!conversation.choose(2));
+  QVERIFY(conversation.choose(0));
+  QCOMPARE(conversation.kind(), uint32_t(ConditionNode));
+  QVERIFY(conversation.choose(1));
+  QVERIFY(conversation.finished());
+
+  Conversation jump(&script, 4);
+  QCOMPARE(jump.kind(), uint32_t(JumpNode));
+  jump.skipJumps();
+  QCOMPARE(jump.node(), 1u);
+
+  // Nodes from game code are checked like choices are
+  QVERIFY(!jump.jump(script.nodeCount()));
+  QCOMPARE(jump.node(), 1u);
+  QVERIFY(jump.jump(DialogueRuntime::End));
+  QVERIFY(jump.finished());
+  QVERIFY(Conversation(&script, script.nodeCount()).finished());
+}
+
+void CoreTest::corruptScript_data()
+{
+  QTest::addColumn<int>("offset");
+  QTest::addColumn<quint32>("value");
+  QTest::addColumn<int>("truncate");
+
+  const int nodes = sizeof(DialogueRuntime::FileHeader);
+  const int choices = nodes + 6 * sizeof(DialogueRuntime::NodeRecord);
+  QTest::newRow("magic") << 0 << quint32(0x58585858) << -1;
+  QTest::newRow("version") << 4 << quint32(2) << -1;
+  QTest::newRow("byte order") << 4 << quint32(0x01000000) << -1;
+  QTest::newRow("entry") << 24 << quint32(6) << -1;
+  QTest::newRow("node text") << nodes << quint32(1000) << -1;
+  QTest::newRow("node kind") << nodes + 12 << quint32(DialogueRuntime::NodeKindCount) << -1;
+  QTest::newRow("node choices") << nodes + 8 << quint32(1000) << -1;
+  QTest::newRow("choice target") << choices + 4 << quint32(6) << -1;
+  QTest::newRow("short") << 0 << quint32(0) << choices;
+}
+
+void CoreTest::corruptScript()
+{
+  QFETCH(int, offset);
+  QFETCH(quint32, value);
+  QFETCH(int, truncate);
+
+  QBuffer buffer;
+  buffer.open(QIODevice::WriteOnly);
+  QVERIFY(ScriptExporter().write(buffer, sampleGraph()));
+  size_t size = truncate >= 0 ? size_t(truncate) : size_t(buffer.size());
+  std::vector<quint32> data((size_t(buffer.size()) + 3) / 4);
+  std::memcpy(data.data(), buffer.data().constData(), size_t(buffer.size()));
+  if (truncate < 0)
+  {
+    value = qToLittleEndian(value);
+    std::memcpy(reinterpret_cast<char*>(data.data()) + offset, &value, sizeof(value));
+  }
+
+  DialogueRuntime::Script script;
+  QVERIFY(!script.load(data.data(), size));
+  QVERIFY(!script.isLoaded());
+}
+
+void CoreTest::spatialGrid()
+{
+  SpatialGrid grid(100);
+  grid.update(0, QRectF(0, 0, 50, 50));
+  grid.update(1, QRectF(150, 150, 120, 50));
+  grid.update(2, QRectF(-300, 400, 50, 50));
+  QCOMPARE(grid.size(), 3u);
+  QCOMPARE(grid.at(QPointF(10, 10)), NodeId(0));
+  QCOMPARE(grid.at(QPointF(260, 160)), NodeId(1));
+  QCOMPARE(grid.at(QPointF(80, 80)), NoId);
+
+  std::vector<NodeId> hits = grid.query(QRectF(-10, -10, 300, 300));
+  std::sort(hits.begin(), hits.end());
+  QCOMPARE(hits, (std::vector<NodeId>{0, 1}));
+  QCOMPARE(grid.bounds(), QRectF(QPointF(-300, 0), QPointF(270, 450)));
+
+  // Moving the outermost nodes inward or removing them shrinks the bounds
+  grid.update(2, QRectF(0, 100, 50, 50));
+  QCOMPARE(grid.bounds(), QRectF(QPointF(0, 0), QPointF(270, 200)));
+  grid.remove(1);
+  QVERIFY(!grid.contains(1));
+  QCOMPARE(grid.bounds(), QRectF(QPointF(0, 0), QPointF(50, 150)));
+  QVERIFY(grid.query(QRectF(140, 140, 200, 200)).empty());
+
+  grid.clear();
+  QCOMPARE(grid.size(), 0u);
+  QVERIFY(grid.bounds().isNull());
+}
+
+QTEST_MAIN(CoreTest)
+#include "coretest.moc"
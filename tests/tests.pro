@@ -0,0 +1,18 @@
+#-------------------------------------------------
+#
+# Checks for the headless core: graph, project files, exported scripts,
+# analysis and the spatial index. Run with
+#   QT_QPA_PLATFORM=offscreen ./coretest
+#
+#-------------------------------------------------
+
+CONFIG   += c++11 testcase
+QT       += core gui widgets testlib
+
+TARGET    = coretest
+TEMPLATE  = app
+
+include(../DialogueNode.pri)
+
+SOURCES += \
+    coretest.cpp